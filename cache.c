@@ -0,0 +1,148 @@
+/*
+ * lru tile cache
+ * entries hang in a chained hash table for lookup and in a doubly linked list ordered by last use,
+ * so both lookups and evictions are constant time
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+
+/* types */
+
+typedef struct _cache_entry {
+	cache_key key;
+	struct _cache_entry *prev, *next; /* use order, head is the most recent */
+	struct _cache_entry* chain; /* next entry in the same bucket */
+	float counts[]; /* tile_size * tile_size */
+} cache_entry;
+
+/* globals */
+
+static int edge;
+static size_t entry_size, budget_bytes;
+static cache_entry** buckets;
+static unsigned num_buckets; /* power of two */
+static cache_entry *head, *tail;
+static cache_stats stats;
+
+/* defs */
+
+static unsigned key_hash(const cache_key* k) {
+	unsigned long long h = 1469598103934665603ull;
+
+	h = (h ^ (unsigned long long) k->level) * 1099511628211ull;
+	h = (h ^ (unsigned long long) k->tx) * 1099511628211ull;
+	h = (h ^ (unsigned long long) k->ty) * 1099511628211ull;
+	h = (h ^ (unsigned long long) k->max_iter) * 1099511628211ull;
+
+	return (unsigned) (h ^ (h >> 32)) & (num_buckets - 1);
+}
+
+static int key_equal(const cache_key* a, const cache_key* b) {
+	return a->level == b->level && a->tx == b->tx && a->ty == b->ty && a->max_iter == b->max_iter;
+}
+
+static void unlink_entry(cache_entry* e) {
+	if (e->prev) e->prev->next = e->next; else head = e->next;
+	if (e->next) e->next->prev = e->prev; else tail = e->prev;
+}
+
+static void push_front(cache_entry* e) {
+	e->prev = NULL;
+	e->next = head;
+
+	if (head) head->prev = e; else tail = e;
+	head = e;
+}
+
+static cache_entry* find(const cache_key* k) {
+	for (cache_entry* e = buckets[key_hash(k)]; e; e = e->chain) {
+		if (key_equal(&e->key, k)) return e;
+	}
+
+	return NULL;
+}
+
+static void evict(cache_entry* e) {
+	cache_entry** link = buckets + key_hash(&e->key);
+
+	while (*link != e) link = &(*link)->chain;
+	*link = e->chain;
+
+	unlink_entry(e);
+	free(e);
+
+	stats.tiles--;
+	stats.bytes -= entry_size;
+}
+
+void cache_init(size_t budget, int tile_size) {
+	size_t capacity;
+
+	edge = tile_size;
+	entry_size = sizeof(cache_entry) + (size_t) tile_size * tile_size * sizeof(float);
+	budget_bytes = budget;
+
+	/* keep chains short at full capacity */
+	capacity = budget / entry_size + 1;
+	for (num_buckets = 1; num_buckets < 2 * capacity; num_buckets *= 2);
+
+	buckets = calloc(num_buckets, sizeof *buckets);
+}
+
+void cache_destroy(void) {
+	cache_clear();
+	free(buckets);
+	buckets = NULL;
+}
+
+void cache_clear(void) {
+	while (head) evict(head);
+}
+
+const float* cache_get(const cache_key* k) {
+	cache_entry* e = find(k);
+
+	if (!e) {
+		stats.misses++;
+		return NULL;
+	}
+
+	unlink_entry(e);
+	push_front(e);
+	stats.hits++;
+
+	return e->counts;
+}
+
+void cache_put(const cache_key* k, const float* src, int stride) {
+	cache_entry* e = find(k);
+
+	if (entry_size > budget_bytes) return;
+
+	if (e) {
+		unlink_entry(e);
+	} else {
+		while (stats.bytes + entry_size > budget_bytes) evict(tail);
+
+		e = malloc(entry_size);
+		e->key = *k;
+		e->chain = buckets[key_hash(k)];
+		buckets[key_hash(k)] = e;
+
+		stats.tiles++;
+		stats.bytes += entry_size;
+	}
+
+	push_front(e);
+
+	for (int y = 0; y < edge; ++y) {
+		memcpy(e->counts + y * edge, src + (size_t) y * stride, edge * sizeof *e->counts);
+	}
+}
+
+cache_stats cache_get_stats(void) {
+	return stats;
+}
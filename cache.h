@@ -0,0 +1,32 @@
+#pragma once
+
+/*
+ * tile cache : finished iteration counts on a fixed grid, addressed by zoom level and grid position
+ * least recently used tiles are dropped once the memory budget is reached
+ * only the main thread touches the cache, so nothing here is locked
+ */
+
+#include <stddef.h>
+
+/* types */
+
+typedef struct _cache_key {
+	int level; /* zoom level, each one halves the pixel spacing */
+	long long tx, ty; /* grid position in tiles, the grid is anchored where the level's pixel 0 sits */
+	int max_iter;
+} cache_key;
+
+typedef struct _cache_stats {
+	long hits, misses;
+	int tiles;
+	size_t bytes;
+} cache_stats;
+
+/* decls */
+
+void cache_init(size_t budget, int tile_size); /* budget in bytes, tiles are tile_size x tile_size counts */
+void cache_destroy(void);
+void cache_clear(void);
+const float* cache_get(const cache_key* k); /* NULL on a miss, rows bottom to top */
+void cache_put(const cache_key* k, const float* src, int stride); /* copies tile_size rows of src, stride floats apart */
+cache_stats cache_get_stats(void);
@@ -0,0 +1,449 @@
+/*
+ * iteration kernels : float, double, long double, double-double and mpfr escape-time loops
+ * frame_init() inspects the pixel spacing and picks the cheapest tier that can resolve it,
+ * handing anything beyond native precision to the perturbation engine when it is enabled
+ */
+
+#include <float.h>
+#include <math.h>
+
+#include "kernel.h"
+#include "simd.h"
+
+/* native kernels */
+
+#define KERNEL_REAL float
+#define KERNEL_NAME iterate_f
+#include "kernel_real.h"
+
+#define KERNEL_REAL double
+#define KERNEL_NAME iterate_d
+#include "kernel_real.h"
+
+#define KERNEL_REAL long double
+#define KERNEL_NAME iterate_ld
+#include "kernel_real.h"
+
+/* double-double arithmetic (dekker/knuth error-free transforms) */
+
+static ddouble dd_quick_two_sum(double a, double b) {
+	ddouble r;
+	r.hi = a + b;
+	r.lo = b - (r.hi - a);
+	return r;
+}
+
+static ddouble dd_two_sum(double a, double b) {
+	ddouble r;
+	double bb;
+
+	r.hi = a + b;
+	bb = r.hi - a;
+	r.lo = (a - (r.hi - bb)) + (b - bb);
+
+	return r;
+}
+
+static void dd_split(double a, double* hi, double* lo) {
+	double t = 134217729.0 * a; /* 2^27 + 1 */
+	*hi = t - (t - a);
+	*lo = a - *hi;
+}
+
+static ddouble dd_two_prod(double a, double b) {
+	ddouble r;
+	double ah, al, bh, bl;
+
+	dd_split(a, &ah, &al);
+	dd_split(b, &bh, &bl);
+
+	r.hi = a * b;
+	r.lo = ((ah * bh - r.hi) + ah * bl + al * bh) + al * bl;
+
+	return r;
+}
+
+static ddouble dd_add(ddouble a, ddouble b) {
+	ddouble s = dd_two_sum(a.hi, b.hi);
+	return dd_quick_two_sum(s.hi, s.lo + a.lo + b.lo);
+}
+
+static ddouble dd_sub(ddouble a, ddouble b) {
+	ddouble s = dd_two_sum(a.hi, -b.hi);
+	return dd_quick_two_sum(s.hi, s.lo + a.lo - b.lo);
+}
+
+static ddouble dd_mul(ddouble a, ddouble b) {
+	ddouble p = dd_two_prod(a.hi, b.hi);
+	return dd_quick_two_sum(p.hi, p.lo + a.hi * b.lo + a.lo * b.hi);
+}
+
+static ddouble dd_mul_d(ddouble a, double b) {
+	ddouble p = dd_two_prod(a.hi, b);
+	return dd_quick_two_sum(p.hi, p.lo + a.lo * b);
+}
+
+static int iterate_dd(ddouble cr, ddouble ci, int max_iter, int period, double eps) {
+	ddouble zr = {0}, zi = {0}, zr2, zi2, pr = {0}, pi = {0};
+	int i, steps = 0, window = period;
+
+	for (i = 0; i < max_iter; ++i) {
+		zr2 = dd_mul(zr, zr);
+		zi2 = dd_mul(zi, zi);
+
+		if (zr2.hi + zi2.hi >= MBR_DIVERGE_THRESHOLD) break;
+
+		zi = dd_mul(zr, zi);
+		zi.hi *= 2.0; /* exact */
+		zi.lo *= 2.0;
+		zi = dd_add(zi, ci);
+		zr = dd_add(dd_sub(zr2, zi2), cr);
+
+		if (!period) continue;
+
+		if (fabs(dd_sub(zr, pr).hi) < eps && fabs(dd_sub(zi, pi).hi) < eps) return MBR_PERIODIC;
+
+		if (++steps == window) {
+			pr = zr;
+			pi = zi;
+			steps = 0;
+			window *= 2;
+		}
+	}
+
+	return i;
+}
+
+static ddouble mpfr_get_dd(mpfr_t v, mpfr_t tmp) {
+	ddouble r;
+
+	r.hi = mpfr_get_d(v, MPFR_RNDD);
+	mpfr_sub_d(tmp, v, r.hi, MPFR_RNDD);
+	r.lo = mpfr_get_d(tmp, MPFR_RNDD);
+
+	return r;
+}
+
+/* mpfr kernel */
+
+void scratch_init(mpfr_scratch* s, long prec) {
+	s->prec = prec;
+
+	mpfr_init2(s->cur_r, prec);
+	mpfr_init2(s->cur_i, prec);
+	mpfr_init2(s->inp_r, prec);
+	mpfr_init2(s->inp_i, prec);
+	mpfr_init2(s->dist, prec);
+	mpfr_init2(s->dist2, prec);
+	mpfr_init2(s->rt, prec);
+	mpfr_init2(s->per_r, prec);
+	mpfr_init2(s->per_i, prec);
+}
+
+void scratch_prepare(mpfr_scratch* s, long prec) {
+	if (s->prec == prec) return;
+
+	s->prec = prec;
+
+	mpfr_set_prec(s->cur_r, prec);
+	mpfr_set_prec(s->cur_i, prec);
+	mpfr_set_prec(s->inp_r, prec);
+	mpfr_set_prec(s->inp_i, prec);
+	mpfr_set_prec(s->dist, prec);
+	mpfr_set_prec(s->dist2, prec);
+	mpfr_set_prec(s->rt, prec);
+	mpfr_set_prec(s->per_r, prec);
+	mpfr_set_prec(s->per_i, prec);
+}
+
+void scratch_clear(mpfr_scratch* s) {
+	mpfr_clear(s->cur_r);
+	mpfr_clear(s->cur_i);
+	mpfr_clear(s->inp_r);
+	mpfr_clear(s->inp_i);
+	mpfr_clear(s->dist);
+	mpfr_clear(s->dist2);
+	mpfr_clear(s->rt);
+	mpfr_clear(s->per_r);
+	mpfr_clear(s->per_i);
+}
+
+static int close_mpfr(mpfr_t a, mpfr_t b, mpfr_t tmp, long exp) {
+	mpfr_sub(tmp, a, b, MPFR_RNDD);
+	return mpfr_zero_p(tmp) || mpfr_get_exp(tmp) <= exp;
+}
+
+static int iterate_mp(const frame* f, mpfr_scratch* s, int x, int y) {
+	int i, steps = 0, window = f->period;
+
+	mpfr_mul_si(s->inp_r, f->step_x, x, MPFR_RNDD);
+	mpfr_mul_si(s->inp_i, f->step_y, y, MPFR_RNDD);
+
+	mpfr_add(s->inp_r, s->inp_r, f->left, MPFR_RNDD);
+	mpfr_add(s->inp_i, s->inp_i, f->bottom, MPFR_RNDD);
+
+	mpfr_set_d(s->cur_r, 0.0, MPFR_RNDD);
+	mpfr_set_d(s->cur_i, 0.0, MPFR_RNDD);
+	mpfr_set_d(s->per_r, 0.0, MPFR_RNDD);
+	mpfr_set_d(s->per_i, 0.0, MPFR_RNDD);
+
+	for (i = 0; i < f->max_iter; ++i) {
+		mpfr_mul(s->dist, s->cur_r, s->cur_r, MPFR_RNDD);
+		mpfr_mul(s->dist2, s->cur_i, s->cur_i, MPFR_RNDD);
+
+		mpfr_add(s->dist, s->dist, s->dist2, MPFR_RNDD);
+
+		if (mpfr_cmp_d(s->dist, MBR_DIVERGE_THRESHOLD) >= 0) break;
+
+		mpfr_sub(s->dist, s->dist, s->dist2, MPFR_RNDD);
+		mpfr_sub(s->rt, s->dist, s->dist2, MPFR_RNDD);
+		mpfr_add(s->rt, s->rt, s->inp_r, MPFR_RNDD);
+
+		mpfr_mul(s->cur_i, s->cur_r, s->cur_i, MPFR_RNDD);
+		mpfr_mul_2ui(s->cur_i, s->cur_i, 1, MPFR_RNDD);
+		mpfr_add(s->cur_i, s->cur_i, s->inp_i, MPFR_RNDD);
+		mpfr_swap(s->cur_r, s->rt);
+
+		if (!f->period) continue;
+
+		if (close_mpfr(s->cur_r, s->per_r, s->dist, f->period_exp) && close_mpfr(s->cur_i, s->per_i, s->dist, f->period_exp)) return MBR_PERIODIC;
+
+		if (++steps == window) {
+			mpfr_set(s->per_r, s->cur_r, MPFR_RNDD);
+			mpfr_set(s->per_i, s->cur_i, MPFR_RNDD);
+			steps = 0;
+			window *= 2;
+		}
+	}
+
+	return i;
+}
+
+int iterate_mpfr(const frame* f, mpfr_scratch* s, int x, int y) {
+	int i = iterate_mp(f, s, x, y);
+	return i == MBR_PERIODIC ? f->max_iter : i;
+}
+
+/* dispatch */
+
+long required_bits(mpfr_t left, mpfr_t right, mpfr_t top, mpfr_t bottom, int width, int height) {
+	long step_exp, mag_exp = 2; /* orbits up to the escape radius need exponent 2 regardless of the view */
+	mpfr_t step;
+	mpfr_ptr bounds[4] = { left, right, top, bottom };
+
+	mpfr_init2(step, mpfr_get_prec(left));
+
+	mpfr_sub(step, right, left, MPFR_RNDD);
+	mpfr_div_si(step, step, width - 1, MPFR_RNDD);
+	step_exp = mpfr_get_exp(step);
+
+	mpfr_sub(step, top, bottom, MPFR_RNDD);
+	mpfr_div_si(step, step, height - 1, MPFR_RNDD);
+	if (mpfr_get_exp(step) < step_exp) step_exp = mpfr_get_exp(step);
+
+	mpfr_clear(step);
+
+	for (int i = 0; i < 4; ++i) {
+		if (!mpfr_zero_p(bounds[i]) && mpfr_get_exp(bounds[i]) > mag_exp) {
+			mag_exp = mpfr_get_exp(bounds[i]);
+		}
+	}
+
+	return mag_exp - step_exp + TIER_GUARD_BITS;
+}
+
+void frame_init(frame* f, mpfr_t left, mpfr_t right, mpfr_t top, mpfr_t bottom, int width, int height, int perturb, int period, int max_iter) {
+	mpfr_t tmp;
+	mpfr_scratch s;
+
+	f->width = width;
+	f->height = height;
+	f->max_iter = max_iter;
+	f->bits = required_bits(left, right, top, bottom, width, height);
+
+	if (f->bits <= FLT_MANT_DIG) {
+		f->tier = TIER_FLOAT;
+	} else if (f->bits <= DBL_MANT_DIG) {
+		f->tier = TIER_DOUBLE;
+	} else if (LDBL_MANT_DIG > DBL_MANT_DIG && f->bits <= LDBL_MANT_DIG) {
+		f->tier = TIER_LDOUBLE;
+	} else if (perturb) {
+		f->tier = TIER_PERTURB;
+	} else if (f->bits <= 2 * DBL_MANT_DIG) {
+		f->tier = TIER_DDOUBLE;
+	} else {
+		f->tier = TIER_MPFR;
+	}
+
+	/* always keep enough precision to split the view into double-doubles */
+	f->prec = f->bits > 2 * DBL_MANT_DIG ? f->bits : 2 * DBL_MANT_DIG;
+	f->prec = (f->prec + MPFR_PREC_STEP - 1) / MPFR_PREC_STEP * MPFR_PREC_STEP;
+
+	mpfr_init2(f->left, f->prec);
+	mpfr_init2(f->bottom, f->prec);
+	mpfr_init2(f->step_x, f->prec);
+	mpfr_init2(f->step_y, f->prec);
+	mpfr_init2(tmp, f->prec);
+
+	mpfr_set(f->left, left, MPFR_RNDD);
+	mpfr_set(f->bottom, bottom, MPFR_RNDD);
+
+	mpfr_sub(f->step_x, right, left, MPFR_RNDD);
+	mpfr_div_si(f->step_x, f->step_x, width - 1, MPFR_RNDD);
+	mpfr_sub(f->step_y, top, bottom, MPFR_RNDD);
+	mpfr_div_si(f->step_y, f->step_y, height - 1, MPFR_RNDD);
+
+	f->left_d = mpfr_get_d(f->left, MPFR_RNDD);
+	f->bottom_d = mpfr_get_d(f->bottom, MPFR_RNDD);
+	f->step_x_d = mpfr_get_d(f->step_x, MPFR_RNDD);
+	f->step_y_d = mpfr_get_d(f->step_y, MPFR_RNDD);
+
+	f->left_ld = mpfr_get_ld(f->left, MPFR_RNDD);
+	f->bottom_ld = mpfr_get_ld(f->bottom, MPFR_RNDD);
+	f->step_x_ld = mpfr_get_ld(f->step_x, MPFR_RNDD);
+	f->step_y_ld = mpfr_get_ld(f->step_y, MPFR_RNDD);
+
+	/* padded bounding boxes of the cardioid and the bulb */
+	f->bulbs = f->left_d <= 0.26 && f->left_d + f->step_x_d * (width - 1) >= -1.26
+		&& f->bottom_d <= 0.66 && f->bottom_d + f->step_y_d * (height - 1) >= -0.66;
+
+	/* cycles are only trusted well below the pixel spacing */
+	f->period = period;
+	f->period_exp = (mpfr_get_exp(f->step_x) < mpfr_get_exp(f->step_y) ? mpfr_get_exp(f->step_x) : mpfr_get_exp(f->step_y)) - PERIOD_TOLERANCE_SHIFT;
+	f->period_eps_d = ldexp(1.0, f->period_exp);
+	f->period_eps_ld = ldexpl(1.0L, f->period_exp);
+
+	f->left_dd = mpfr_get_dd(f->left, tmp);
+	f->bottom_dd = mpfr_get_dd(f->bottom, tmp);
+	f->step_x_dd = mpfr_get_dd(f->step_x, tmp);
+	f->step_y_dd = mpfr_get_dd(f->step_y, tmp);
+
+	if (f->tier == TIER_PERTURB) {
+		scratch_init(&s, f->prec);
+
+		f->ref.x = width / 2;
+		f->ref.y = height / 2;
+
+		mpfr_mul_si(s.inp_r, f->step_x, f->ref.x, MPFR_RNDD);
+		mpfr_add(s.inp_r, s.inp_r, f->left, MPFR_RNDD);
+		mpfr_mul_si(s.inp_i, f->step_y, f->ref.y, MPFR_RNDD);
+		mpfr_add(s.inp_i, s.inp_i, f->bottom, MPFR_RNDD);
+
+		ref_orbit_init(&f->ref, &s, max_iter);
+
+		/* leave room for the deltas to shrink well below the pixel spacing */
+		f->ref_ld = mpfr_get_exp(f->step_x) < DBL_MIN_EXP + DBL_MANT_DIG || mpfr_get_exp(f->step_y) < DBL_MIN_EXP + DBL_MANT_DIG;
+
+		series_init(f);
+
+		scratch_clear(&s);
+	}
+
+	mpfr_clear(tmp);
+}
+
+void frame_clear(frame* f) {
+	if (f->tier == TIER_PERTURB) ref_orbit_clear(&f->ref);
+
+	mpfr_clear(f->left);
+	mpfr_clear(f->bottom);
+	mpfr_clear(f->step_x);
+	mpfr_clear(f->step_y);
+}
+
+static int pixel_raw(const frame* f, mpfr_scratch* s, int x, int y) {
+	switch (f->tier) {
+	case TIER_FLOAT:
+		return iterate_f((float) (f->left_d + f->step_x_d * x), (float) (f->bottom_d + f->step_y_d * y), f->max_iter, f->period, (float) f->period_eps_d);
+	case TIER_DOUBLE:
+		return iterate_d(f->left_d + f->step_x_d * x, f->bottom_d + f->step_y_d * y, f->max_iter, f->period, f->period_eps_d);
+	case TIER_LDOUBLE:
+		return iterate_ld(f->left_ld + f->step_x_ld * x, f->bottom_ld + f->step_y_ld * y, f->max_iter, f->period, f->period_eps_ld);
+	case TIER_DDOUBLE:
+		return iterate_dd(dd_add(f->left_dd, dd_mul_d(f->step_x_dd, x)), dd_add(f->bottom_dd, dd_mul_d(f->step_y_dd, y)), f->max_iter, f->period, f->period_eps_d);
+	case TIER_PERTURB:
+		return perturb_pixel(f, &f->ref, x, y); /* deltas cannot resolve a cycle of the full orbit, no periodicity check */
+	default:
+		return iterate_mp(f, s, x, y);
+	}
+}
+
+int compute_pixel(const frame* f, mpfr_scratch* s, int x, int y) {
+	int i = pixel_raw(f, s, x, y);
+	return i == MBR_PERIODIC ? f->max_iter : i;
+}
+
+static int in_bulbs_ld(long double cr, long double ci, long double margin) {
+	long double ci2 = ci * ci;
+	long double xr = cr - 0.25L, q = xr * xr + ci2;
+
+	if (q * (q + xr) < 0.25L * ci2 - margin) return 1;
+	return (cr + 1) * (cr + 1) + ci2 < 0.0625L - margin;
+}
+
+int in_bulbs(const frame* f, int x, int y) {
+	if (!f->bulbs) return 0;
+
+	/* test the same point the tier iterates; deeper tiers only accept points clearly inside */
+	switch (f->tier) {
+	case TIER_FLOAT:
+	case TIER_DOUBLE:
+		return in_bulbs_ld(f->left_d + f->step_x_d * x, f->bottom_d + f->step_y_d * y, 0);
+	case TIER_LDOUBLE:
+		return in_bulbs_ld(f->left_ld + f->step_x_ld * x, f->bottom_ld + f->step_y_ld * y, 0);
+	default:
+		return in_bulbs_ld(f->left_ld + f->step_x_ld * x, f->bottom_ld + f->step_y_ld * y, BULB_MARGIN);
+	}
+}
+
+static void iterate_run(const frame* f, mpfr_scratch* s, int x, int y, int n, int* out, span_stats* st) {
+	/* shallow views run through the vector kernel, which iterates in double even for the float tier */
+	if ((f->tier == TIER_FLOAT || f->tier == TIER_DOUBLE) && iterate_span) {
+		iterate_span(f->left_d, f->step_x_d, x, f->bottom_d + f->step_y_d * y, n, f->max_iter, f->period, f->period_eps_d, out);
+	} else {
+		for (int i = 0; i < n; ++i) {
+			out[i] = pixel_raw(f, s, x + i, y);
+		}
+	}
+
+	for (int i = 0; i < n; ++i) {
+		if (out[i] == MBR_PERIODIC) {
+			out[i] = f->max_iter;
+			st->periodic++;
+		}
+
+		if (out[i] == f->max_iter) st->interior++;
+	}
+}
+
+void compute_span(const frame* f, mpfr_scratch* s, int x, int y, int n, int* out, span_stats* st) {
+	if (!f->bulbs) {
+		iterate_run(f, s, x, y, n, out, st);
+		return;
+	}
+
+	/* interior points are marked directly, the runs between them are iterated */
+	for (int i = 0; i < n;) {
+		int j = i;
+
+		while (j < n && !in_bulbs(f, x + j, y)) ++j;
+
+		if (j > i) iterate_run(f, s, x + i, y, j - i, out + i, st);
+		if (j == n) break;
+
+		out[j] = f->max_iter;
+		st->bulb++;
+		i = j + 1;
+	}
+}
+
+const char* tier_name(precision_tier t) {
+	switch (t) {
+	case TIER_FLOAT: return "float";
+	case TIER_DOUBLE: return "double";
+	case TIER_LDOUBLE: return "long double";
+	case TIER_DDOUBLE: return "double-double";
+	case TIER_PERTURB: return "perturbation";
+	default: return "mpfr";
+	}
+}
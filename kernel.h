@@ -0,0 +1,92 @@
+#pragma once
+
+/*
+ * iteration kernels
+ * each frame picks the cheapest number type that can still resolve its pixel spacing
+ */
+
+#include <gmp.h>
+#include <mpfr.h>
+
+#include "perturb.h"
+
+/* mandelbrot generation parameters */
+
+#define MBR_MAX_ITERATIONS 128 /* default iteration cap, each frame carries its own */
+#define MBR_DIVERGE_THRESHOLD 4
+#define MBR_PERIODIC -3 /* raw kernel result for an orbit caught in a cycle, reported as the frame's max_iter */
+
+/* precision selection */
+
+#define TIER_GUARD_BITS 12 /* extra mantissa bits required beyond the pixel spacing before a tier is trusted */
+#define MPFR_PREC_STEP 64 /* mpfr precision is rounded up to whole limbs */
+#define PERIOD_TOLERANCE_SHIFT 4 /* orbit points closer than the pixel spacing / 2^shift count as a cycle */
+#define BULB_MARGIN 1e-17L /* how far inside the bulbs a point must be when the long double test is only an estimate */
+
+/* types */
+
+typedef enum _precision_tier {
+	TIER_FLOAT,
+	TIER_DOUBLE,
+	TIER_LDOUBLE,
+	TIER_DDOUBLE,
+	TIER_PERTURB,
+	TIER_MPFR,
+} precision_tier;
+
+typedef struct _ddouble {
+	double hi, lo;
+} ddouble;
+
+/* preallocated mpfr temporaries, one set per compute thread, so the mpfr loops never allocate */
+typedef struct _mpfr_scratch {
+	long prec;
+	mpfr_t cur_r, cur_i, inp_r, inp_i, dist, dist2, rt;
+	mpfr_t per_r, per_i; /* orbit point saved by the periodicity check */
+} mpfr_scratch;
+
+/* per-span counters, accumulated by compute_span */
+typedef struct _span_stats {
+	long bulb; /* rejected by the closed form bulb test */
+	long periodic; /* orbits caught in a cycle before max_iter */
+	long interior; /* iterated orbits that never escaped, periodic ones included */
+} span_stats;
+
+/* immutable snapshot of the view, built once per frame and shared by all compute threads */
+typedef struct _frame {
+	int width, height;
+	int max_iter;
+	precision_tier tier;
+	long bits; /* mantissa bits required to resolve the pixel spacing */
+	long prec; /* mpfr precision used by TIER_MPFR and the reference orbit */
+
+	double left_d, bottom_d, step_x_d, step_y_d;
+	long double left_ld, bottom_ld, step_x_ld, step_y_ld;
+	ddouble left_dd, bottom_dd, step_x_dd, step_y_dd;
+	mpfr_t left, bottom, step_x, step_y;
+
+	int bulbs; /* the view overlaps the main cardioid or the period-2 bulb */
+
+	int period; /* initial brent window of the periodicity check, 0 disables it */
+	double period_eps_d; /* cycle tolerance for the native and double-double kernels */
+	long double period_eps_ld;
+	long period_exp; /* cycle tolerance of the mpfr kernel as a binary exponent */
+
+	ref_orbit ref; /* TIER_PERTURB only, computed at the center pixel */
+	int ref_ld; /* deltas are iterated in long double because the spacing underflows a double */
+	series sa; /* lets pixels against the primary reference skip the start of the orbit */
+} frame;
+
+/* decls */
+
+long required_bits(mpfr_t left, mpfr_t right, mpfr_t top, mpfr_t bottom, int width, int height);
+void frame_init(frame* f, mpfr_t left, mpfr_t right, mpfr_t top, mpfr_t bottom, int width, int height, int perturb, int period, int max_iter);
+void frame_clear(frame* f);
+void scratch_init(mpfr_scratch* s, long prec);
+void scratch_prepare(mpfr_scratch* s, long prec); /* no-op unless the precision changed */
+void scratch_clear(mpfr_scratch* s);
+int compute_pixel(const frame* f, mpfr_scratch* s, int x, int y); /* returns the iteration count, max_iter if the point never diverged, or PERTURB_GLITCH */
+int iterate_mpfr(const frame* f, mpfr_scratch* s, int x, int y);
+int in_bulbs(const frame* f, int x, int y); /* closed form test for the main cardioid and the period-2 bulb */
+void compute_span(const frame* f, mpfr_scratch* s, int x, int y, int n, int* out, span_stats* st); /* n pixels starting at (x, y) going right */
+const char* tier_name(precision_tier t);
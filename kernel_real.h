@@ -0,0 +1,39 @@
+/*
+ * escape-time loop for a native floating point type
+ * included by kernel.c once per type, with KERNEL_REAL and KERNEL_NAME defined
+ */
+
+static int KERNEL_NAME(KERNEL_REAL cr, KERNEL_REAL ci, int max_iter, int period, KERNEL_REAL eps) {
+	KERNEL_REAL zr = 0, zi = 0, zr2, zi2, pr = 0, pi = 0, dr, di;
+	int i, steps = 0, window = period;
+
+	for (i = 0; i < max_iter; ++i) {
+		zr2 = zr * zr;
+		zi2 = zi * zi;
+
+		if (zr2 + zi2 >= MBR_DIVERGE_THRESHOLD) break;
+
+		zi = 2 * zr * zi + ci;
+		zr = zr2 - zi2 + cr;
+
+		if (!period) continue;
+
+		/* brent: compare against the point saved at the start of the window, doubling the window as it runs out */
+		dr = zr - pr;
+		di = zi - pi;
+
+		if ((dr < 0 ? -dr : dr) < eps && (di < 0 ? -di : di) < eps) return MBR_PERIODIC;
+
+		if (++steps == window) {
+			pr = zr;
+			pi = zi;
+			steps = 0;
+			window *= 2;
+		}
+	}
+
+	return i;
+}
+
+#undef KERNEL_REAL
+#undef KERNEL_NAME
@@ -1,6 +1,7 @@
 /*
  * mini-mandelbrot : multithreaded mandelbrot renderer
- * the screen is recursively divided in a quadtree-like manner to divide the work between threads
+ * the screen is cut into small tiles which a pool of workers, one per core, pull from work-stealing deques
+ * the workers live for the whole run, a new view only bumps the generation they check between rows
  */
 
 #include <stdlib.h>
@@ -14,11 +15,46 @@
 
 #include <signal.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
 
+#ifndef MBR_HEADLESS
 #include <GLXW/glxw.h>
 #include <GLFW/glfw3.h>
 
+/* gl 2.1 fallback for the iteration texture, missing from core profile headers */
+#ifndef GL_LUMINANCE
+#define GL_LUMINANCE 0x1909
+#endif
+#ifndef GL_LUMINANCE32F_ARB
+#define GL_LUMINANCE32F_ARB 0x8818
+#endif
+#else
+/* built with make headless: no window and no gl, the keys navigate understands keep their glfw codes */
+typedef struct GLFWwindow GLFWwindow;
+
+#define GLFW_KEY_SPACE 32
+#define GLFW_KEY_C 67
+#define GLFW_KEY_G 71
+#define GLFW_KEY_M 77
+#define GLFW_KEY_P 80
+#define GLFW_KEY_LEFT_BRACKET 91
+#define GLFW_KEY_RIGHT_BRACKET 93
+#define GLFW_KEY_BACKSPACE 259
+#define GLFW_KEY_RIGHT 262
+#define GLFW_KEY_LEFT 263
+#define GLFW_KEY_DOWN 264
+#define GLFW_KEY_UP 265
+#endif
+
 #include "shaders.h"
+#include "kernel.h"
+#include "simd.h"
+#include "sched.h"
+#include "cache.h"
+#include "store.h"
 
 /* window parameters */
 
@@ -26,23 +62,36 @@
 #define HEIGHT 768
 #define TITLE "mandelbrot"
 #define FS 1
+#define IDLE_TIMEOUT 0.5 /* longest sleep of the main loop, paces the upload stats and SIGINT */
+#define PBO_RING 3 /* pixel buffer objects cycled through for texture uploads */
+#define PALETTE_SIZE 256 /* entries of the 1D palette texture */
+#define NUM_PALETTES 3
+#define TAU 6.283185307179586
 
-/* mandelbrot generation parameters */
-
-#define MBR_MAX_ITERATIONS 128
-#define MBR_DIVERGE_THRESHOLD 4
+/* view parameters */
 
-#define BOUND_LEFT -2.5
-#define BOUND_RIGHT 1
-#define BOUND_TOP 1
+#define BOUND_TOP 1 /* height of the default view, its width follows the aspect ratio */
 #define BOUND_BOTTOM -1
+#define DEFAULT_CENTER "-0.75,0" /* center of the default view, used without -c */
 
-#define PBITS 512
+#define PBITS 512 /* initial precision of the view bounds, grown as the view zooms in */
 
 /* thread and calculation parameters */
 
-#define THR_MAX_ACTIVE 4 /* maximum number of active CPU threads created to deal with each subdivision */
+#define TILE_SIZE 64 /* edge length of the unit of work handed to the pool */
 #define SUBDIV_MIN_SIZE 50 /* smallest area for a subdivision */
+#define PERIOD_CHECK 8 /* initial brent window of the periodicity check */
+#define COUNT_PENDING -2 /* tile pixels the subdivision has not iterated yet */
+#define COUNT_KNOWN -3 /* coarse samples already in iterbuf, left alone */
+#define ITER_BLANK -1.0f /* iteration buffer value of a pixel not computed yet, drawn white */
+#define ITER_PREVIEW(v) (-2.0f - (v)) /* not computed yet either, but drawn with count v until it is */
+#define PASSES 4 /* progressive refinement levels, see pass_strides */
+#define PROGRESSIVE_MS 100 /* frames slower than this are refined progressively */
+#define CACHE_BUDGET 256 /* default tile cache size in MB, set with -m */
+#define FRAMES_PER_OCTAVE 30 /* video frames per 2x of zoom, set with -f */
+#define STORE_DIR "mini-mandelbrot" /* tile store directory under $XDG_CACHE_HOME or ~/.cache, replaced with -d */
+#define STORE_BUDGET 1024 /* MB of tile files kept in the store directory, least recently used go first */
+#define LATTICE_LIMIT (1LL << 52) /* the grid position is rebased before repeated zooms overflow it */
 
 /* types */
 
@@ -50,93 +99,625 @@ typedef struct _pixel {
 	uint8_t r, g, b, a;
 } pixel;
 
-typedef struct _mandelbrot_params {
-	int left, right, top, bottom, thr_index;
-} mandelbrot_params;
-
-typedef struct _img {
-	mpfr_t r, i;
-} img;
+/* per-worker tile memory, grown to the largest tile seen and reused for every tile after that */
+typedef struct _tile_buffer {
+	int cap; /* pixels */
+	int* counts;
+	int* work; /* 2 * cap, flood fill space for glitch correction */
+} tile_buffer;
+
+/* a frame shared by the passes refining it, freed once the last one is released */
+typedef struct _render {
+	frame f;
+	atomic_int refs;
+} render;
+
+/* context of one pool batch: iterate the blank pixels on multiples of stride, preview the rest */
+typedef struct _frame_pass {
+	render* r;
+	int stride;
+	int last;
+	unsigned id;
+} frame_pass;
 
 /* globals */
 
-GLFWwindow* win;
+GLFWwindow* win; /* NULL in headless mode */
 int r;
-unsigned tex, vs, fs, prg;
+int redraw; /* the texture is current but the window still has to be drawn */
+unsigned tex, palette_tex, vs, fs, prg;
+unsigned iter_internal, iter_format; /* float format of the iteration texture, see pick_iter_format */
+unsigned pbos[PBO_RING];
+int pbo_next;
 mpfr_t bound_left, bound_right, bound_top, bound_bottom;
+int perturbation = 1; /* deep views iterate deltas against a reference orbit, toggled with P */
+int subdivide = 1; /* mariani-silver: rectangles with a uniform border are filled without iterating, toggled with M */
+int periodicity = PERIOD_CHECK; /* halved and doubled with [ and ], 0 disables the check */
+int width = WIDTH, height = HEIGHT; /* render resolution, set with -s and followed on window resize */
+int max_iterations = MBR_MAX_ITERATIONS; /* set with -i */
+long cache_budget = CACHE_BUDGET; /* MB */
+char store_dir[4096]; /* empty disables the tile store */
+int palette_index; /* cycled with C */
+int progressive = 1; /* slow frames are refined coarse to fine, toggled with G */
+pixel palette[PALETTE_SIZE]; /* maps iteration / max_iter to a color, mirrored in the palette texture */
+
+float* iterbuf; /* iteration count per pixel, negative until computed, workers write disjoint tiles */
+atomic_int* tile_dirty; /* set once a tile is fully written, cleared when the texture picks it up */
+atomic_int publishing; /* workers currently reading their tile's seeds from iterbuf or writing it back */
+
+pthread_mutex_t done_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER; /* signalled when a frame finishes, for headless mode */
+int frame_finished;
+double last_frame_ms; /* duration of the last finished frame, under done_mutex */
+
+render* current_render; /* main thread only */
+int current_pass; /* index into pass_strides */
+unsigned submitted_pass; /* id of the last pass handed to the pool, written under done_mutex */
+atomic_uint finished_pass; /* id of the last pass the pool finished, set under done_mutex */
+
+tile* tiles; /* grid covering the screen, rebuilt when the resolution changes */
+int num_tiles, tiles_x; /* tiles_x tiles per row, rows ordered bottom to top */
+tile* upload_rects; /* dirty runs collected by one upload pass, at most one per tile */
+tile* pending_tiles; /* tiles of the grid still holding blank pixels, handed to the pool */
 
-pixel pixbuf[WIDTH * HEIGHT];
-pthread_mutex_t pixbuf_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-pthread_t threads[THR_MAX_ACTIVE];
-int live_threads[THR_MAX_ACTIVE]; /* binary flag array signifying which thread slots are available */
-int num_live_threads;
-pthread_mutex_t live_threads_mutex = PTHREAD_MUTEX_INITIALIZER; /* each thread needs to know when they can make new threads, so we have to implement mutexes */
+/*
+ * pans and zooms move the view along a lattice, so cached tiles can be addressed by integers:
+ * pixel (0, 0) of the screen is pixel (view_x, view_y) of level view_level, and pixel p of level n
+ * sits where pixel 2p of level n + 1 does. anything else, like a resize, starts a new lattice
+ */
+int view_level;
+long long view_x, view_y;
+int frame_stored; /* the finished frame's tiles went to the cache and the store */
+mpfr_scratch* scratch; /* one per pool worker */
+tile_buffer* buffers; /* one per pool worker */
+
+struct timespec frame_start;
+atomic_long mpfr_allocs; /* gmp/mpfr heap allocations since the current frame started */
+atomic_int glitch_refs; /* extra reference orbits computed by glitch correction this frame */
+atomic_long filled_pixels; /* pixels filled from a uniform border instead of iterated this frame */
+atomic_long bulb_pixels; /* pixels found inside the cardioid or period-2 bulb without iterating this frame */
+atomic_long periodic_pixels; /* iterated interior pixels cut short by the periodicity check this frame */
+atomic_long interior_pixels; /* iterated pixels that never escaped this frame */
 
 /* consts */
 const pixel pix_white = { 0xFF, 0xFF, 0xFF, 0xFF };
 const pixel pix_black = { 0x00, 0x00, 0x00, 0x00 };
+const char* palette_names[NUM_PALETTES] = { "classic", "grayscale", "bands" };
+const int pass_strides[PASSES] = { 16, 4, 2, 1 }; /* divide TILE_SIZE so every block stays inside its tile */
 
 /* decls */
 
+int usage(const char* argv0);
+int set_view(const char* center, const char* zoom, const char* depth); /* replaces the bounds with a view of the given center and magnification, precise enough to zoom on to depth */
+int run_headless(const char* path); /* renders a single frame and writes it to path */
+int write_ppm(const char* path);
+int run_video(const char* pattern, const char* zoom, int per_octave, int out_width, int out_height); /* zooms from 1 to zoom, pattern "-" streams raw rgb to stdout */
+int frame_pattern_valid(const char* pattern); /* one %d or %0Nd and nothing else for snprintf to expand */
+void wait_frame(void); /* drives the passes of the current frame until it is complete */
+void interpolate_frame(float* const keys[2], double spacing, unsigned char* rgb, int out_width, int out_height); /* spacing is in pixels of keys[0] per output pixel */
+void sample_key(const float* key, double x, double y, unsigned char* rgb); /* bilinear, in color space */
+int run_window(void); /* interactive mode, returns once the window is closed */
+int pick_iter_format(void); /* r32f from gl 3.0 or texture_rg, luminance32f on plain gl 2.1, 1 without float textures */
+void build_tiles(void);
+long upload_dirty_tiles(void); /* returns the number of bytes sent to the texture */
+void resize_view(int new_width, int new_height); /* keeps the center and pixel spacing of the bounds */
+void resize_callback(GLFWwindow* win, int new_width, int new_height);
+void refresh_callback(GLFWwindow* win);
 void trap_sigint(int _);
-void flush_pixels(pixel color);
-int get_thr_slot(void);
-void start_mandelbrot(void); /* starts all of the compute threads */
-void* compute_mandelbrot(void* param); /* pthread main for compute threads */
-void compute_mandelbrot_sub(int left, int right, int top, int bottom);
-pixel get_color(int ind);
+void* count_alloc(size_t size);
+void* count_realloc(void* ptr, size_t old_size, size_t new_size);
+void count_free(void* ptr, size_t size);
+void flush_pixels(float value);
+void shift_pixels(int dx, int dy); /* the new pixel (x, y) takes the old (x + dx, y + dy), uncovered pixels go blank */
+long zoom_pixels(int kx, int ky); /* the new pixel (2x, 2y) takes the old (kx + x, ky + y), the others preview it, returns the pixels kept */
+long unzoom_pixels(int ox, int oy); /* the new pixel (x, y) takes the old (2x - ox, 2y - oy), returns the pixels kept */
+void mark_tiles_dirty(void);
+long long floor_div(long long a, long long b);
+void reset_lattice(void); /* forgets the lattice position and everything cached on it, then opens the store of the new one */
+unsigned long long lattice_id(void); /* hash of everything that places the lattice or shapes its counts: origin, spacing, max_iter and the P, M, [ ] settings */
+void cache_store_view(void); /* caches and stores every lattice tile fully on screen and fully computed */
+void cache_load_view(void); /* fills blank pixels from cached or stored lattice tiles */
+void retire_frame(void); /* cancels the frame in progress and waits out tiles already being written */
+void start_mandelbrot(void); /* retires the frame in progress and hands every tile of a new one to the pool */
+void shift_mandelbrot(int dx, int dy); /* same for a view panned by whole pixels, keeping what is still on screen */
+void zoom_mandelbrot(int kx, int ky); /* same for a 2x zoom whose left and bottom edges sit on the old pixel (kx, ky) */
+void unzoom_mandelbrot(int ox, int oy); /* same for a 2x zoom out, the old pixel (0, 0) becomes the new (ox / 2, oy / 2) */
+void submit_frame(void); /* snapshots the view and starts its first pass */
+void submit_pass(void); /* hands the tiles with blank pixels to the pool for the current pass */
+int advance_frame(void); /* starts the next pass once the previous one finished, returns 1 once the frame is complete */
+void run_tile(int worker, const tile* t, void* ctx, unsigned gen); /* pool callback for a single tile */
+void frame_done(void* ctx); /* pool callback once the last tile of a pass is finished */
+void frame_release(void* ctx); /* pool callback once no worker still reads a retired pass */
+void wake_main_loop(void); /* lets the window's event loop pick up finished work, a no-op without a window */
+void tile_buffer_prepare(tile_buffer* b, int size);
+void compute_mandelbrot_sub(const frame* f, mpfr_scratch* s, tile_buffer* b, unsigned gen, int left, int right, int top, int bottom);
+void compute_coarse(const frame* f, mpfr_scratch* s, tile_buffer* b, unsigned gen, int stride, int left, int right, int top, int bottom); /* one sample per stride x stride block */
+void compute_pending(const frame* f, mpfr_scratch* s, int* row, int x, int y, int n, span_stats* st); /* iterates the pending pixels among n starting at row */
+void subdivide_rect(const frame* f, mpfr_scratch* s, unsigned gen, span_stats* st, int* counts, int stride, int left, int bottom, int x, int y, int w, int h);
+pixel get_color(int ind, int max_iter);
+void build_palette(int index);
+void upload_palette(void);
+pixel shade(float it, int max_iter); /* cpu copy of fs_palette_lookup, used for image output */
 void key_callback(GLFWwindow* win, int key, int scancode, int action, int mods);
+void navigate(int key); /* applies a key binding, also used to step the video renderer */
 
 /* defs */
 
 int main(int argc, char** argv) {
+	const char *output = NULL, *center = NULL, *zoom = NULL, *video = NULL;
+	const char* xdg = getenv("XDG_CACHE_HOME");
+	int opt, status, per_octave = FRAMES_PER_OCTAVE, out_width, out_height;
+
+	if (xdg && *xdg) {
+		snprintf(store_dir, sizeof store_dir, "%s/" STORE_DIR, xdg);
+	} else if (getenv("HOME")) {
+		snprintf(store_dir, sizeof store_dir, "%s/.cache/" STORE_DIR, getenv("HOME"));
+	}
+
+	/* parse arguments */
+
+	while ((opt = getopt(argc, argv, "o:c:z:s:i:m:d:v:f:")) != -1) {
+		switch (opt) {
+		case 'o':
+			output = optarg;
+			break;
+		case 'c':
+			center = optarg;
+			break;
+		case 'z':
+			zoom = optarg;
+			break;
+		case 's':
+			if (sscanf(optarg, "%dx%d", &width, &height) != 2 || width < 2 || height < 2) return usage(argv[0]);
+			break;
+		case 'i':
+			if ((max_iterations = atoi(optarg)) < 1) return usage(argv[0]);
+			break;
+		case 'm':
+			if ((cache_budget = atol(optarg)) < 0) return usage(argv[0]);
+			break;
+		case 'd':
+			snprintf(store_dir, sizeof store_dir, "%s", optarg);
+			break;
+		case 'v':
+			video = optarg;
+			if (strcmp(video, "-") && !frame_pattern_valid(video)) return usage(argv[0]);
+			break;
+		case 'f':
+			if ((per_octave = atoi(optarg)) < 1) return usage(argv[0]);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
 	/* prepare globals */
 
-	num_live_threads = 0;
+	mp_set_memory_functions(count_alloc, count_realloc, count_free); /* must precede every gmp/mpfr allocation */
+
+	simd_init();
+	build_palette(palette_index);
+	printf("using %s span kernel\n", iterate_span_name);
 
 	mpfr_init2(bound_left, PBITS);
 	mpfr_init2(bound_right, PBITS);
 	mpfr_init2(bound_top, PBITS);
 	mpfr_init2(bound_bottom, PBITS);
 
-	mpfr_set_d(bound_left, BOUND_LEFT, MPFR_RNDD);
-	mpfr_set_d(bound_right, BOUND_RIGHT, MPFR_RNDD);
-	mpfr_set_d(bound_top, BOUND_TOP, MPFR_RNDD);
-	mpfr_set_d(bound_bottom, BOUND_BOTTOM, MPFR_RNDD);
+	out_width = width;
+	out_height = height;
+
+	/*
+	 * video keyframes are rendered at twice the output size so frames never magnify them.
+	 * sizes of the form 4n + 1 make the lattice zoom exact, so the keyframes stay centered
+	 */
+	if (video) {
+		width = 2 * width + ((2 * width) % 4 ? 3 : 1);
+		height = 2 * height + ((2 * height) % 4 ? 3 : 1);
+	}
 
-	for (int i = 0; i < THR_MAX_ACTIVE; ++i) {
-		live_threads[i] = 0;
+	/* the default view goes through set_view too, so its pixels are square at any size */
+	if (set_view(center ? center : DEFAULT_CENTER, zoom && !video ? zoom : "1", zoom ? zoom : "1")) {
+		printf("invalid center or zoom\n");
+		return usage(argv[0]);
+	}
+
+	iterbuf = malloc(width * height * sizeof *iterbuf);
+	build_tiles();
+
+	pool_init(run_tile, frame_done, frame_release);
+	cache_init((size_t) cache_budget << 20, TILE_SIZE);
+
+	scratch = malloc(pool_size() * sizeof *scratch);
+	buffers = calloc(pool_size(), sizeof *buffers);
+
+	for (int i = 0; i < pool_size(); ++i) {
+		scratch_init(scratch + i, MPFR_PREC_STEP); /* regrown to each frame's precision by the worker */
+		tile_buffer_prepare(buffers + i, TILE_SIZE * TILE_SIZE);
 	}
 
 	signal(SIGINT, trap_sigint);
 
+	if (video) {
+		status = run_video(video, zoom ? zoom : "1", per_octave, out_width, out_height);
+	} else {
+		status = output ? run_headless(output) : run_window();
+	}
+
+	/* cleanup */
+
+	printf("terminating cleanly\n");
+
+	pool_destroy(); /* also releases the last frame */
+	cache_destroy();
+	store_close();
+
+	mpfr_clear(bound_left);
+	mpfr_clear(bound_right);
+	mpfr_clear(bound_top);
+	mpfr_clear(bound_bottom);
+
+	for (int i = 0; i < pool_size(); ++i) {
+		scratch_clear(scratch + i);
+		free(buffers[i].counts);
+		free(buffers[i].work);
+	}
+
+	free(scratch);
+	free(buffers);
+	free(tiles);
+	free(tile_dirty);
+	free(upload_rects);
+	free(pending_tiles);
+	free(iterbuf);
+
+	return status;
+}
+
+int usage(const char* argv0) {
+	printf("usage: %s [-o out.ppm] [-c re,im] [-z zoom] [-s WIDTHxHEIGHT] [-i max_iterations] [-m cache_mb] [-d store_dir] [-v frames | -] [-f frames_per_2x]\n", argv0);
+	printf("  without -o the view is shown in a window, with it a single frame is written without opening one\n");
+	printf("  finished tiles are kept in %s, an empty -d disables that\n", *store_dir ? store_dir : "no store");
+	printf("  -v renders a zoom from 1 to -z towards -c, as numbered ppm files (one %%d or %%05d in the name) or raw rgb24 on stdout (-), -f frames per 2x of zoom\n");
+	return 7;
+}
+
+int set_view(const char* center, const char* zoom, const char* depth) {
+	mpfr_t cr, ci, z, half_w, half_h;
+	const char* comma = strchr(center, ',');
+	char* re;
+	long prec;
+	int bad;
+
+	if (!comma) return 1;
+
+	/*
+	 * the deepest zoom decides how many bits the bounds need. the center is parsed once,
+	 * digits cut here could not be recovered when a video zooms in further
+	 */
+	mpfr_init2(z, MPFR_PREC_STEP);
+	if (mpfr_set_str(z, depth, 10, MPFR_RNDD) || mpfr_sgn(z) <= 0) {
+		mpfr_clear(z);
+		return 1;
+	}
+
+	prec = PBITS + (mpfr_get_exp(z) > 0 ? mpfr_get_exp(z) : 0);
+
+	if (mpfr_set_str(z, zoom, 10, MPFR_RNDD) || mpfr_sgn(z) <= 0) {
+		mpfr_clear(z);
+		return 1;
+	}
+
+	if (mpfr_get_exp(z) > prec - PBITS) prec = PBITS + mpfr_get_exp(z);
+
+	mpfr_init2(cr, prec);
+	mpfr_init2(ci, prec);
+	mpfr_init2(half_w, prec);
+	mpfr_init2(half_h, prec);
+
+	re = strndup(center, comma - center);
+	bad = mpfr_set_str(cr, re, 10, MPFR_RNDD) || mpfr_set_str(ci, comma + 1, 10, MPFR_RNDD);
+	free(re);
+
+	if (!bad) {
+		/* zoom 1 shows the default view height, the width follows the aspect ratio */
+		mpfr_set_d(half_h, (BOUND_TOP - BOUND_BOTTOM) / 2.0, MPFR_RNDD);
+		mpfr_div(half_h, half_h, z, MPFR_RNDD);
+		mpfr_mul_si(half_w, half_h, width, MPFR_RNDD);
+		mpfr_div_si(half_w, half_w, height, MPFR_RNDD);
+
+		mpfr_set_prec(bound_left, prec);
+		mpfr_set_prec(bound_right, prec);
+		mpfr_set_prec(bound_top, prec);
+		mpfr_set_prec(bound_bottom, prec);
+
+		mpfr_sub(bound_left, cr, half_w, MPFR_RNDD);
+		mpfr_add(bound_right, cr, half_w, MPFR_RNDD);
+		mpfr_sub(bound_bottom, ci, half_h, MPFR_RNDD);
+		mpfr_add(bound_top, ci, half_h, MPFR_RNDD);
+	}
+
+	mpfr_clear(cr);
+	mpfr_clear(ci);
+	mpfr_clear(z);
+	mpfr_clear(half_w);
+	mpfr_clear(half_h);
+
+	return bad;
+}
+
+int run_headless(const char* path) {
+	progressive = 0; /* nobody looks at the coarse passes */
+	start_mandelbrot();
+	wait_frame();
+
+	return write_ppm(path);
+}
+
+int frame_pattern_valid(const char* pattern) {
+	int conversions = 0;
+
+	for (const char* c = pattern; *c; ++c) {
+		if (*c != '%') continue;
+
+		if (*++c == '%') continue; /* a literal percent sign */
+
+		/* a width only with the zero flag, space padded names would not sort */
+		if (*c == '0') {
+			while (*c >= '0' && *c <= '9') ++c;
+		}
+
+		if (*c != 'd') return 0;
+
+		conversions++;
+	}
+
+	return conversions == 1;
+}
+
+void wait_frame(void) {
+	do {
+		pthread_mutex_lock(&done_mutex);
+		while (!frame_finished && atomic_load(&finished_pass) != submitted_pass) pthread_cond_wait(&done_cond, &done_mutex);
+		pthread_mutex_unlock(&done_mutex);
+	} while (!advance_frame());
+}
+
+int write_ppm(const char* path) {
+	FILE* out = fopen(path, "wb");
+	unsigned char* row = malloc(width * 3);
+
+	if (!out) {
+		printf("failed to open %s\n", path);
+		free(row);
+		return 8;
+	}
+
+	fprintf(out, "P6\n%d %d\n255\n", width, height);
+
+	/* iterbuf rows run bottom to top like the texture, image rows top to bottom */
+	for (int y = height - 1; y >= 0; --y) {
+		for (int x = 0; x < width; ++x) {
+			pixel p = shade(iterbuf[y * width + x], max_iterations);
+
+			row[x * 3] = p.r;
+			row[x * 3 + 1] = p.g;
+			row[x * 3 + 2] = p.b;
+		}
+
+		fwrite(row, 3, width, out);
+	}
+
+	free(row);
+
+	if (fclose(out)) {
+		printf("failed to write %s\n", path);
+		return 8;
+	}
+
+	printf("wrote %dx%d image to %s\n", width, height, path);
+	return 0;
+}
+
+int run_video(const char* pattern, const char* zoom, int per_octave, int out_width, int out_height) {
+	size_t key_bytes = (size_t) width * height * sizeof *iterbuf;
+	float* keys[2] = { malloc(key_bytes), malloc(key_bytes) };
+	unsigned char* rgb = malloc(out_width * out_height * 3);
+	FILE* stream = NULL;
+	double octaves, spacing;
+	int octs, frames, n = 0, status = 0;
+	mpfr_t z;
+
+	mpfr_init2(z, MPFR_PREC_STEP);
+	if (mpfr_set_str(z, zoom, 10, MPFR_RNDD) || mpfr_cmp_ui(z, 1) < 0) {
+		printf("the video zoom must be at least 1\n");
+		status = 7;
+	}
+
+	mpfr_log2(z, z, MPFR_RNDD);
+	octaves = status ? 0 : mpfr_get_d(z, MPFR_RNDD);
+	mpfr_clear(z);
+
+	octs = octaves > 1 ? (int) ceil(octaves) : 1;
+	frames = (int) floor(octaves * per_octave) + 1;
+
+	/* raw frames take over stdout, the log moves to stderr */
+	if (!status && !strcmp(pattern, "-")) {
+		stream = fdopen(dup(1), "wb");
+		dup2(2, 1);
+	}
+
+	progressive = 0; /* nobody looks at the coarse passes */
+
+	/* keyframe pixels per output pixel at keyframe 0, the same in both directions */
+	spacing = fmin((double) (width - 1) / (out_width - 1), (double) (height - 1) / (out_height - 1));
+
+	if (!status) {
+		start_mandelbrot();
+		wait_frame();
+		memcpy(keys[0], iterbuf, key_bytes);
+	}
+
+	/*
+	 * only the 2x keyframes are rendered, each one reached by the same zoom step SPACE takes so it reuses
+	 * a quarter of the previous one plus whatever the tile store holds. frames in between are resampled
+	 */
+	for (int k = 0; k < octs && !status; ++k) {
+		float* swap;
+
+		navigate(GLFW_KEY_SPACE);
+		wait_frame();
+		memcpy(keys[1], iterbuf, key_bytes);
+
+		for (; n < frames && (n < (k + 1) * per_octave || k == octs - 1) && !status; ++n) {
+			char path[4096];
+			FILE* out = stream;
+
+			interpolate_frame(keys, spacing * pow(2, k - (double) n / per_octave), rgb, out_width, out_height);
+
+			if (!stream) {
+				snprintf(path, sizeof path, pattern, n);
+
+				if (!(out = fopen(path, "wb"))) {
+					printf("failed to open %s\n", path);
+					status = 8;
+					break;
+				}
+
+				fprintf(out, "P6\n%d %d\n255\n", out_width, out_height);
+			}
+
+			if (fwrite(rgb, 3, out_width * out_height, out) != (size_t) out_width * out_height) status = 8;
+			if (!stream && fclose(out)) status = 8;
+		}
+
+		printf("keyframe %d of %d done, %d of %d frames written\n", k + 1, octs, n, frames);
+
+		swap = keys[0];
+		keys[0] = keys[1];
+		keys[1] = swap;
+	}
+
+	if (stream && fclose(stream)) status = 8;
+	if (!status) printf("rendered %d keyframes for %d frames\n", octs + 1, frames);
+
+	free(keys[0]);
+	free(keys[1]);
+	free(rgb);
+
+	return status;
+}
+
+void interpolate_frame(float* const keys[2], double spacing, unsigned char* rgb, int out_width, int out_height) {
+	double cx = (width - 1) / 2.0, cy = (height - 1) / 2.0;
+
+	/* image rows run top to bottom, keyframe rows bottom to top */
+	for (int row = 0; row < out_height; ++row) {
+		double v = (out_height - 1 - row) - (out_height - 1) / 2.0;
+
+		for (int x = 0; x < out_width; ++x) {
+			double u = x - (out_width - 1) / 2.0;
+			double x1 = cx + u * 2 * spacing, y1 = cy + v * 2 * spacing;
+			unsigned char* dst = rgb + (row * out_width + x) * 3;
+
+			/* the next keyframe is sharper wherever it reaches */
+			if (x1 >= 0 && x1 <= width - 1 && y1 >= 0 && y1 <= height - 1) {
+				sample_key(keys[1], x1, y1, dst);
+			} else {
+				sample_key(keys[0], cx + u * spacing, cy + v * spacing, dst);
+			}
+		}
+	}
+}
+
+void sample_key(const float* key, double x, double y, unsigned char* rgb) {
+	int x0, y0;
+	double fx, fy;
+	pixel p[4];
+
+	x = x < 0 ? 0 : x > width - 1 ? width - 1 : x;
+	y = y < 0 ? 0 : y > height - 1 ? height - 1 : y;
+
+	x0 = x < width - 1 ? (int) x : width - 2;
+	y0 = y < height - 1 ? (int) y : height - 2;
+	fx = x - x0;
+	fy = y - y0;
+
+	p[0] = shade(key[y0 * width + x0], max_iterations);
+	p[1] = shade(key[y0 * width + x0 + 1], max_iterations);
+	p[2] = shade(key[(y0 + 1) * width + x0], max_iterations);
+	p[3] = shade(key[(y0 + 1) * width + x0 + 1], max_iterations);
+
+	rgb[0] = (1 - fy) * ((1 - fx) * p[0].r + fx * p[1].r) + fy * ((1 - fx) * p[2].r + fx * p[3].r) + 0.5;
+	rgb[1] = (1 - fy) * ((1 - fx) * p[0].g + fx * p[1].g) + fy * ((1 - fx) * p[2].g + fx * p[3].g) + 0.5;
+	rgb[2] = (1 - fy) * ((1 - fx) * p[0].b + fx * p[1].b) + fy * ((1 - fx) * p[2].b + fx * p[3].b) + 0.5;
+}
+
+#ifdef MBR_HEADLESS
+int run_window(void) {
+	printf("built without a window, render with -o or -v\n");
+	return 1;
+}
+#else
+int run_window(void) {
 	/* quickly prepare context info */
 
 	if (!glfwInit()) return 1;
-	if (!(win = glfwCreateWindow(WIDTH, HEIGHT, TITLE, FS ? glfwGetPrimaryMonitor() : NULL, NULL))) return 2;
+	if (!(win = glfwCreateWindow(width, height, TITLE, FS ? glfwGetPrimaryMonitor() : NULL, NULL))) return 2;
 	glfwMakeContextCurrent(win);
 	if (glxwInit()) return 3;
+	if (pick_iter_format()) return 4;
 
+	glfwSwapInterval(1);
 	glfwSetKeyCallback(win, key_callback);
+	glfwSetFramebufferSizeCallback(win, resize_callback);
+	glfwSetWindowRefreshCallback(win, refresh_callback);
+
+	/* fullscreen and hidpi framebuffers often differ from the requested size, and no callback reports the first one */
+	int fb_width = width, fb_height = height;
+	glfwGetFramebufferSize(win, &fb_width, &fb_height);
+
+	if (fb_width >= 2 && fb_height >= 2 && (fb_width != width || fb_height != height)) {
+		printf("framebuffer is %dx%d\n", fb_width, fb_height);
+		resize_view(fb_width, fb_height);
+
+		width = fb_width;
+		height = fb_height;
+		iterbuf = realloc(iterbuf, width * height * sizeof *iterbuf);
+
+		build_tiles();
+	}
 
 	/* prepare GL state */
 
-	glViewport(0, 0, WIDTH, HEIGHT);
+	glViewport(0, 0, width, height);
 	glClearColor(0.0f, 0.0f, 1.0f, 0.0f);
 
 	glGenTextures(1, &tex);
 	glBindTexture(GL_TEXTURE_2D, tex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, WIDTH, HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexImage2D(GL_TEXTURE_2D, 0, iter_internal, width, height, 0, iter_format, GL_FLOAT, NULL);
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
+	/* the palette lives on its own unit */
+	glActiveTexture(GL_TEXTURE1);
+	glGenTextures(1, &palette_tex);
+	glBindTexture(GL_TEXTURE_1D, palette_tex);
+	glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA, PALETTE_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, palette);
+
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glActiveTexture(GL_TEXTURE0);
+
+	glGenBuffers(PBO_RING, pbos);
+
 	vs = glCreateShader(GL_VERTEX_SHADER);
 	fs = glCreateShader(GL_FRAGMENT_SHADER);
 
 	glShaderSource(vs, 1, &vs_passthrough, NULL);
-	glShaderSource(fs, 1, &fs_passthrough, NULL);
+	glShaderSource(fs, 1, &fs_palette_lookup, NULL);
 
 	glCompileShader(vs);
 	glCompileShader(fs);
@@ -158,6 +739,8 @@ int main(int argc, char** argv) {
 
 	glUseProgram(prg);
 	glUniform1i(glGetUniformLocation(prg, "fs_texture"), 0);
+	glUniform1i(glGetUniformLocation(prg, "fs_palette"), 1);
+	glUniform1f(glGetUniformLocation(prg, "fs_max_iter"), max_iterations);
 	glActiveTexture(GL_TEXTURE0);
 
 	float verts[24] = {
@@ -175,44 +758,44 @@ int main(int argc, char** argv) {
 	glEnableVertexAttribArray(1);
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 4, verts + 2);
 
-	flush_pixels(pix_white);
-
 	/* start mainloop */
 
+	struct timespec upload_start, now;
+	long upload_bytes = 0, bytes;
+	double elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &upload_start);
 	start_mandelbrot();
 
 	r = 1;
 	while (r) {
-		glfwPollEvents();
+		/* sleep until input arrives or a worker posts a finished tile */
+		glfwWaitEventsTimeout(IDLE_TIMEOUT);
 
 		r &= !glfwWindowShouldClose(win);
 		r &= !glfwGetKey(win, GLFW_KEY_ESCAPE);
 
-		glClear(GL_COLOR_BUFFER_BIT);
+		advance_frame();
+		bytes = upload_dirty_tiles();
+		upload_bytes += bytes;
 
-		pthread_mutex_lock(&pixbuf_mutex); /* ensure that the pixbuf is safe for reading */
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixbuf);
-		pthread_mutex_unlock(&pixbuf_mutex);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - upload_start.tv_sec) + (now.tv_nsec - upload_start.tv_nsec) / 1e9;
 
-		glDrawArrays(GL_TRIANGLES, 0, 6);
+		if (elapsed >= 1.0) {
+			if (upload_bytes) printf("uploaded %.2f MB/s to the texture\n", upload_bytes / elapsed / 1e6);
 
-		glfwSwapBuffers(win);
-	}
+			upload_bytes = 0;
+			upload_start = now;
+		}
 
-	/* cleanup */
+		if (!bytes && !redraw) continue;
+		redraw = 0;
 
-	printf("terminating cleanly\n");
+		glClear(GL_COLOR_BUFFER_BIT);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
 
-	for (int i = 0; i < THR_MAX_ACTIVE; ++i) {
-		pthread_mutex_lock(&live_threads_mutex);
-		if (live_threads[i]) {
-			printf("cancelling workthread %d\n", i);
-			pthread_cancel(threads[i]);
-			printf("done\n");
-			num_live_threads--;
-			live_threads[i] = 0;
-		}
-		pthread_mutex_unlock(&live_threads_mutex);
+		glfwSwapBuffers(win);
 	}
 
 	glDisableVertexAttribArray(0);
@@ -226,179 +809,869 @@ int main(int argc, char** argv) {
 	glDeleteProgram(prg);
 
 	glDeleteTextures(1, &tex);
+	glDeleteTextures(1, &palette_tex);
+	glDeleteBuffers(PBO_RING, pbos);
 
+	retire_frame(); /* no worker posts events to a terminated glfw */
+	cache_store_view(); /* keep what the last frame finished */
 	glfwDestroyWindow(win);
 	glfwTerminate();
-
-	mpfr_clear(bound_left);
-	mpfr_clear(bound_right);
-	mpfr_clear(bound_top);
-	mpfr_clear(bound_bottom);
+	win = NULL;
 
 	return 0;
 }
 
-void* compute_mandelbrot(void* param) {
-	mandelbrot_params* p = (mandelbrot_params*) param;
-	printf("starting compute thread with sector (%d, %d, %d, %d) index %d\n", p->left, p->right, p->top, p->bottom, p->thr_index);
+int pick_iter_format(void) {
+	const char* version = (const char*) glGetString(GL_VERSION);
+	const char* ext = (const char*) glGetString(GL_EXTENSIONS);
+	int has_float = ext && strstr(ext, "GL_ARB_texture_float");
 
-	compute_mandelbrot_sub(p->left, p->right, p->top, p->bottom);
+	/* single channel float textures are core from 3.0, r32f on 2.1 needs both extensions */
+	if ((version && atoi(version) >= 3) || (has_float && strstr(ext, "GL_ARB_texture_rg"))) {
+		iter_internal = GL_R32F;
+		iter_format = GL_RED;
+		return 0;
+	}
 
-	if (p->thr_index >= 0) {
-		pthread_mutex_lock(&live_threads_mutex);
-		live_threads[p->thr_index] = 0;
-		num_live_threads--;
-		pthread_mutex_unlock(&live_threads_mutex);
+	/* luminance samples as (l, l, l, 1), so the shader reads the count from .r all the same */
+	if (has_float) {
+		printf("no GL_ARB_texture_rg, storing iteration counts as luminance\n");
+		iter_internal = GL_LUMINANCE32F_ARB;
+		iter_format = GL_LUMINANCE;
+		return 0;
 	}
 
-	free(p); /* free the parameter set, allocated by start_mandelbrot() */
-	return NULL;
+	printf("this context has no float textures (GL 3.0 or GL_ARB_texture_float), cannot draw iteration counts\n");
+	return 1;
 }
+#endif
+
+void build_tiles(void) {
+	num_tiles = 0;
+	tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+
+	for (int y = 0; y < height; y += TILE_SIZE) {
+		for (int x = 0; x < width; x += TILE_SIZE) {
+			tiles = realloc(tiles, (num_tiles + 1) * sizeof *tiles);
+
+			tiles[num_tiles].left = x;
+			tiles[num_tiles].right = x + TILE_SIZE < width ? x + TILE_SIZE - 1 : width - 1;
+			tiles[num_tiles].bottom = y;
+			tiles[num_tiles].top = y + TILE_SIZE < height ? y + TILE_SIZE - 1 : height - 1;
+
+			num_tiles++;
+		}
+	}
+
+	free(tile_dirty);
+	tile_dirty = calloc(num_tiles, sizeof *tile_dirty);
+	upload_rects = realloc(upload_rects, num_tiles * sizeof *upload_rects);
+	pending_tiles = realloc(pending_tiles, num_tiles * sizeof *pending_tiles);
+}
+
+#ifndef MBR_HEADLESS
+long upload_dirty_tiles(void) {
+	int count = 0;
+	long bytes = 0;
+	uint8_t* dst;
+
+	/* horizontal runs of tiles published since the last pass go up as one rectangle each */
+	for (int row = 0; row * tiles_x < num_tiles; ++row) {
+		for (int col = 0; col < tiles_x; ) {
+			int first = row * tiles_x + col, last = first;
+
+			if (!atomic_exchange_explicit(tile_dirty + first, 0, memory_order_acquire)) {
+				++col;
+				continue;
+			}
+
+			while (last + 1 < (row + 1) * tiles_x && atomic_exchange_explicit(tile_dirty + last + 1, 0, memory_order_acquire)) ++last;
+
+			upload_rects[count] = tiles[first];
+			upload_rects[count].right = tiles[last].right;
+			bytes += (long) (1 + upload_rects[count].right - upload_rects[count].left) * (1 + upload_rects[count].top - upload_rects[count].bottom) * sizeof *iterbuf;
+			count++;
+
+			col += 1 + last - first;
+		}
+	}
+
+	if (!count) return 0;
+
+	/*
+	 * pack the rectangles into the next buffer of the ring and let the GPU pull them from there.
+	 * orphaning the storage first means we never wait for the transfer still reading the previous contents
+	 */
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[pbo_next]);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+	pbo_next = (pbo_next + 1) % PBO_RING;
+
+	if (!(dst = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY))) {
+		/* fall back to a synchronous copy from iterbuf */
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+
+		for (int i = 0; i < count; ++i) {
+			const tile* t = upload_rects + i;
+			glTexSubImage2D(GL_TEXTURE_2D, 0, t->left, t->bottom, 1 + t->right - t->left, 1 + t->top - t->bottom, iter_format, GL_FLOAT, iterbuf + t->bottom * width + t->left);
+		}
+
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		return bytes;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		const tile* t = upload_rects + i;
+		size_t row_bytes = (1 + t->right - t->left) * sizeof *iterbuf;
+
+		for (int y = t->bottom; y <= t->top; ++y) {
+			memcpy(dst, iterbuf + y * width + t->left, row_bytes);
+			dst += row_bytes;
+		}
+	}
+
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	/* with a buffer bound the pointer argument is an offset into it */
+	for (long i = 0, offset = 0; i < count; ++i) {
+		const tile* t = upload_rects + i;
+		int w = 1 + t->right - t->left, h = 1 + t->top - t->bottom;
+
+		glTexSubImage2D(GL_TEXTURE_2D, 0, t->left, t->bottom, w, h, iter_format, GL_FLOAT, (void*) (intptr_t) offset);
+		offset += (long) w * h * sizeof *iterbuf;
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	return bytes;
+}
+#endif
+
+void resize_view(int new_width, int new_height) {
+	mpfr_t center, half;
+
+	mpfr_init2(center, mpfr_get_prec(bound_left));
+	mpfr_init2(half, mpfr_get_prec(bound_left));
+
+	/* half extent = (right - left) / (width - 1) * (new_width - 1) / 2 */
+	mpfr_add(center, bound_left, bound_right, MPFR_RNDD);
+	mpfr_div_2ui(center, center, 1, MPFR_RNDD);
+	mpfr_sub(half, bound_right, bound_left, MPFR_RNDD);
+	mpfr_mul_si(half, half, new_width - 1, MPFR_RNDD);
+	mpfr_div_si(half, half, 2 * (width - 1), MPFR_RNDD);
+	mpfr_sub(bound_left, center, half, MPFR_RNDD);
+	mpfr_add(bound_right, center, half, MPFR_RNDD);
+
+	mpfr_add(center, bound_bottom, bound_top, MPFR_RNDD);
+	mpfr_div_2ui(center, center, 1, MPFR_RNDD);
+	mpfr_sub(half, bound_top, bound_bottom, MPFR_RNDD);
+	mpfr_mul_si(half, half, new_height - 1, MPFR_RNDD);
+	mpfr_div_si(half, half, 2 * (height - 1), MPFR_RNDD);
+	mpfr_sub(bound_bottom, center, half, MPFR_RNDD);
+	mpfr_add(bound_top, center, half, MPFR_RNDD);
+
+	mpfr_clear(center);
+	mpfr_clear(half);
+}
+
+#ifndef MBR_HEADLESS
+void resize_callback(GLFWwindow* win, int new_width, int new_height) {
+	if (new_width < 2 || new_height < 2 || (new_width == width && new_height == height)) return; /* minimized or unchanged */
+
+	printf("resizing to %dx%d\n", new_width, new_height);
+
+	retire_frame(); /* no worker touches iterbuf or the dirty flags past this point */
+	resize_view(new_width, new_height);
+
+	width = new_width;
+	height = new_height;
+	iterbuf = realloc(iterbuf, width * height * sizeof *iterbuf);
+
+	build_tiles();
+
+	glViewport(0, 0, width, height);
+	glTexImage2D(GL_TEXTURE_2D, 0, iter_internal, width, height, 0, iter_format, GL_FLOAT, NULL);
+
+	start_mandelbrot();
+}
+
+void refresh_callback(GLFWwindow* win) {
+	redraw = 1; /* exposed or damaged, the back buffer is not kept */
+}
+#endif
 
 void trap_sigint(int _) {
 	r = 0; /* kill mainloop quietly */
 	printf("caught SIGINT\n");
 }
 
-void flush_pixels(pixel c) {
-	for (int i = 0; i < WIDTH * HEIGHT; ++i) {
-		pixbuf[i] = c;
+void* count_alloc(size_t size) {
+	atomic_fetch_add_explicit(&mpfr_allocs, 1, memory_order_relaxed);
+	return malloc(size);
+}
+
+void* count_realloc(void* ptr, size_t old_size, size_t new_size) {
+	atomic_fetch_add_explicit(&mpfr_allocs, 1, memory_order_relaxed);
+	return realloc(ptr, new_size);
+}
+
+void count_free(void* ptr, size_t size) {
+	free(ptr);
+}
+
+void flush_pixels(float value) {
+	for (int i = 0; i < width * height; ++i) {
+		iterbuf[i] = value;
 	}
+
+	mark_tiles_dirty();
 }
 
-int get_thr_slot(void) {
-	for (int i = 0; i < THR_MAX_ACTIVE; ++i) {
-		if (!live_threads[i]) {
-			return i;
+void shift_pixels(int dx, int dy) {
+	int keep = width - abs(dx);
+
+	/* walk rows away from the ones still to be read so nothing is overwritten early */
+	for (int i = 0; i < height; ++i) {
+		int y = dy > 0 ? i : height - 1 - i;
+		float* row = iterbuf + y * width;
+
+		if (y + dy < 0 || y + dy >= height || keep <= 0) {
+			for (int x = 0; x < width; ++x) row[x] = ITER_BLANK;
+			continue;
+		}
+
+		memmove(row + (dx < 0 ? -dx : 0), iterbuf + (y + dy) * width + (dx > 0 ? dx : 0), keep * sizeof *iterbuf);
+
+		for (int x = 0; x < abs(dx); ++x) {
+			row[dx > 0 ? keep + x : x] = ITER_BLANK;
 		}
 	}
 
-	return -1;
+	mark_tiles_dirty();
 }
 
-void start_mandelbrot(void) {
-	mandelbrot_params* p;
-
-	/* first, stop any computations in progress */
-	for (int i = 0; i < THR_MAX_ACTIVE; ++i) {
-		pthread_mutex_lock(&live_threads_mutex);
-		if (live_threads[i]) {
-			pthread_cancel(threads[i]);
-			live_threads[i] = 0;
-			num_live_threads--;
+long zoom_pixels(int kx, int ky) {
+	float* old = malloc(width * height * sizeof *old);
+	long kept = 0;
+
+	memcpy(old, iterbuf, width * height * sizeof *old);
+
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			float v = old[(ky + y / 2) * width + kx + x / 2];
+
+			if (v == ITER_BLANK) {
+				iterbuf[y * width + x] = ITER_BLANK;
+			} else if (v < 0) {
+				iterbuf[y * width + x] = v; /* a preview stays a preview */
+			} else if (x % 2 || y % 2) {
+				iterbuf[y * width + x] = ITER_PREVIEW(v);
+			} else {
+				iterbuf[y * width + x] = v;
+				kept++;
+			}
 		}
-		pthread_mutex_unlock(&live_threads_mutex);
 	}
 
-	for (int i = 0; i < THR_MAX_ACTIVE; ++i) {
-		p = malloc(sizeof *p);
+	free(old);
 
-		p->left = i * (WIDTH / THR_MAX_ACTIVE);
-		p->right = (i + 1) * (WIDTH / THR_MAX_ACTIVE) - 1;
-		p->top = HEIGHT - 1;
-		p->bottom = 0;
-		p->thr_index = i;
+	mark_tiles_dirty();
+
+	return kept;
+}
 
-		pthread_mutex_lock(&live_threads_mutex);
-		live_threads[i] = 1;
-		num_live_threads++;
-		pthread_mutex_unlock(&live_threads_mutex);
+long unzoom_pixels(int ox, int oy) {
+	float* old = malloc(width * height * sizeof *old);
+	long kept = 0;
 
-		printf("spawning child thread index %d with params (%d, %d, %d, %d)\n", i, p->left, p->right, p->top, p->bottom);
+	memcpy(old, iterbuf, width * height * sizeof *old);
 
-		if (pthread_create(threads + i, NULL, compute_mandelbrot, p)) {
-			printf("failed to spawn thread..\n");
-			exit(10);
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			int sx = 2 * x - ox, sy = 2 * y - oy;
+			float v = sx >= 0 && sx < width && sy >= 0 && sy < height ? old[sy * width + sx] : ITER_BLANK;
+
+			iterbuf[y * width + x] = v;
+			if (v >= 0) kept++;
 		}
 	}
+
+	free(old);
+	mark_tiles_dirty();
+
+	return kept;
 }
 
-void compute_mandelbrot_sub(int left, int right, int top, int bottom) {
-	int sect_width = 1 + right - left, sect_height = 1 + top - bottom;
-	pixel temp_pixbuf[sect_width * sect_height];
+void mark_tiles_dirty(void) {
+	for (int i = 0; i < num_tiles; ++i) {
+		atomic_store_explicit(tile_dirty + i, 1, memory_order_release);
+	}
+}
 
-	memset(temp_pixbuf, 0xFF, sect_width * sect_height * sizeof *temp_pixbuf); /* whiteout */
+long long floor_div(long long a, long long b) {
+	return a / b - (a % b < 0);
+}
 
-	/* because we migrate to a local pixbuf we won't be able to determine overlapping thread sectors at runtime */
+void reset_lattice(void) {
+	int stored;
 
-	for (int y = bottom; y <= top; ++y) {
-		for (int x = left; x <= right; ++x) {
-			int diverge = 0, i;
-			img cur, inp;
+	cache_clear();
+	view_level = 0;
+	view_x = view_y = 0;
 
-			mpfr_init2(cur.r, PBITS);
-			mpfr_init2(cur.i, PBITS);
-			mpfr_init2(inp.r, PBITS);
-			mpfr_init2(inp.i, PBITS);
+	if ((stored = store_open(store_dir, lattice_id(), TILE_SIZE, max_iterations, (size_t) STORE_BUDGET << 20))) printf("tile store holds %d tiles of this lattice\n", stored);
+}
 
-			mpfr_sub(inp.r, bound_right, bound_left, MPFR_RNDD);
-			mpfr_sub(inp.i, bound_top, bound_bottom, MPFR_RNDD);
+unsigned long long lattice_id(void) {
+	unsigned long long h = 1469598103934665603ull;
+	mpfr_t step_x, step_y;
+	char* desc;
 
-			mpfr_mul_d(inp.r, inp.r, (double) x / (double) (WIDTH - 1), MPFR_RNDD);
-			mpfr_mul_d(inp.i, inp.i, (double) y / (double) (HEIGHT - 1), MPFR_RNDD);
+	mpfr_init2(step_x, mpfr_get_prec(bound_left));
+	mpfr_init2(step_y, mpfr_get_prec(bound_left));
 
-			mpfr_add(inp.r, inp.r, bound_left, MPFR_RNDD);
-			mpfr_add(inp.i, inp.i, bound_bottom, MPFR_RNDD);
+	mpfr_sub(step_x, bound_right, bound_left, MPFR_RNDD);
+	mpfr_div_si(step_x, step_x, width - 1, MPFR_RNDD);
+	mpfr_sub(step_y, bound_top, bound_bottom, MPFR_RNDD);
+	mpfr_div_si(step_y, step_y, height - 1, MPFR_RNDD);
 
-			mpfr_set_d(cur.r, 0.0, MPFR_RNDD);
-			mpfr_set_d(cur.i, 0.0, MPFR_RNDD);
+	/*
+	 * hex floats are exact, so the same view always hashes the same.
+	 * the toggles change counts near glitches, filled rectangles and cycles, so each setting gets its own store
+	 */
+	mpfr_asprintf(&desc, "%Ra %Ra %Ra %Ra %d %d %d %d", bound_left, bound_bottom, step_x, step_y, max_iterations, perturbation, subdivide, periodicity);
 
-			for (i = 0; i < MBR_MAX_ITERATIONS; ++i) {
-				mpfr_t dist, dist2, rt;
-				mpfr_init2(dist, PBITS);
-				mpfr_init2(dist2, PBITS);
-				mpfr_init2(rt, PBITS);
+	for (const char* c = desc; *c; ++c) {
+		h = (h ^ (unsigned char) *c) * 1099511628211ull;
+	}
 
-				mpfr_mul(dist, cur.r, cur.r, MPFR_RNDD);
-				mpfr_mul(dist2, cur.i, cur.i, MPFR_RNDD);
+	mpfr_free_str(desc);
+	mpfr_clear(step_x);
+	mpfr_clear(step_y);
 
-				mpfr_add(dist, dist, dist2, MPFR_RNDD);
+	return h;
+}
 
-				if (mpfr_cmp_d(dist, MBR_DIVERGE_THRESHOLD) >= 0) {
-					diverge = 1;
-					break;
+void cache_store_view(void) {
+	/* lattice tiles are TILE_SIZE wide, but generally not aligned with the screen tiles */
+	for (long long ty = floor_div(view_y + TILE_SIZE - 1, TILE_SIZE); ty * TILE_SIZE + TILE_SIZE - view_y <= height; ++ty) {
+		for (long long tx = floor_div(view_x + TILE_SIZE - 1, TILE_SIZE); tx * TILE_SIZE + TILE_SIZE - view_x <= width; ++tx) {
+			cache_key k = { view_level, tx, ty, max_iterations };
+			const float* src = iterbuf + (ty * TILE_SIZE - view_y) * width + tx * TILE_SIZE - view_x;
+			int done = 1;
+
+			for (int y = 0; y < TILE_SIZE && done; ++y) {
+				for (int x = 0; x < TILE_SIZE && done; ++x) {
+					done = src[y * width + x] >= 0;
 				}
+			}
 
-				mpfr_sub(dist, dist, dist2, MPFR_RNDD);
-				mpfr_sub(rt, dist, dist2, MPFR_RNDD);
-				mpfr_add(rt, rt, inp.r, MPFR_RNDD);
+			if (done) {
+				cache_put(&k, src, width);
+				store_put(&k, src, width);
+			}
+		}
+	}
+}
 
-				mpfr_mul(cur.i, cur.r, cur.i, MPFR_RNDD);
-				mpfr_mul_d(cur.i, cur.i, 2.0, MPFR_RNDD);
-				mpfr_add(cur.i, cur.i, inp.i, MPFR_RNDD);
-				mpfr_set(cur.r, rt, MPFR_RNDD);
+void cache_load_view(void) {
+	cache_stats before = cache_get_stats(), after;
+	float disk_tile[TILE_SIZE * TILE_SIZE];
+	long lookups, disk_hits = 0;
+
+	for (long long ty = floor_div(view_y, TILE_SIZE); ty * TILE_SIZE - view_y < height; ++ty) {
+		for (long long tx = floor_div(view_x, TILE_SIZE); tx * TILE_SIZE - view_x < width; ++tx) {
+			cache_key k = { view_level, tx, ty, max_iterations };
+			int x0 = tx * TILE_SIZE - view_x, y0 = ty * TILE_SIZE - view_y;
+			int left = x0 > 0 ? x0 : 0, right = x0 + TILE_SIZE < width ? x0 + TILE_SIZE : width;
+			int bottom = y0 > 0 ? y0 : 0, top = y0 + TILE_SIZE < height ? y0 + TILE_SIZE : height;
+			const float* src;
+			int blank = 0;
+
+			for (int y = bottom; y < top && !blank; ++y) {
+				for (int x = left; x < right && !blank; ++x) {
+					blank = iterbuf[y * width + x] < 0;
+				}
+			}
+
+			/* only tiles still missing pixels count as lookups, memory misses fall through to the store */
+			if (!blank) continue;
 
-				mpfr_clear(dist);
-				mpfr_clear(dist2);
-				mpfr_clear(rt);
+			if (!(src = cache_get(&k))) {
+				if (!store_get(&k, disk_tile)) continue;
+
+				cache_put(&k, disk_tile, TILE_SIZE);
+				src = disk_tile;
+				disk_hits++;
 			}
 
-			/* choose color from palette, where i=MBR_MAX_ITERATIONS should be black */
-			temp_pixbuf[(y - bottom) * sect_width + (x - left)] = get_color(i);
+			for (int y = bottom; y < top; ++y) {
+				for (int x = left; x < right; ++x) {
+					float* dst = iterbuf + y * width + x;
+					if (*dst < 0) *dst = src[(y - y0) * TILE_SIZE + x - x0];
+				}
+			}
+		}
+	}
+
+	after = cache_get_stats();
+	lookups = after.hits + after.misses;
+
+	if (after.hits > before.hits || disk_hits) printf("tile cache hit %ld of %ld tiles and the store %ld more, %.1f%% overall, %d tiles in %.1f MB\n",
+		after.hits - before.hits, lookups - before.hits - before.misses, disk_hits, 100.0 * after.hits / lookups, after.tiles, after.bytes / 1e6);
+}
+
+void retire_frame(void) {
+	pool_cancel();
+
+	/* a worker that saw the old generation is at most one tile copy away from done, in either direction */
+	while (atomic_load(&publishing)) sched_yield();
+}
+
+void start_mandelbrot(void) {
+	/* first, retire the computations in progress; workers notice between rows and never publish stale tiles */
+	retire_frame();
+	reset_lattice(); /* settings or the lattice itself changed, cached tiles no longer match */
+	flush_pixels(ITER_BLANK);
+	cache_load_view(); /* the store may know this lattice from an earlier run */
+	submit_frame();
+}
+
+void shift_mandelbrot(int dx, int dy) {
+	/* tiles the old frame never finished are still blank and get picked up again */
+	retire_frame();
+	cache_store_view();
+	shift_pixels(dx, dy);
+
+	view_x += dx;
+	view_y += dy;
 
-			mpfr_clear(cur.r);
-			mpfr_clear(cur.i);
-			mpfr_clear(inp.r);
-			mpfr_clear(inp.i);
+	cache_load_view();
+	submit_frame();
+}
+
+void zoom_mandelbrot(int kx, int ky) {
+	long kept;
+
+	retire_frame();
+	cache_store_view();
+	kept = zoom_pixels(kx, ky);
+	printf("kept %ld of %d pixels from the previous view\n", kept, width * height);
+
+	view_level++;
+	view_x = 2 * (view_x + kx);
+	view_y = 2 * (view_y + ky);
+
+	if (llabs(view_x) > LATTICE_LIMIT || llabs(view_y) > LATTICE_LIMIT) {
+		reset_lattice();
+	} else {
+		cache_load_view();
+	}
+
+	submit_frame();
+}
+
+void unzoom_mandelbrot(int ox, int oy) {
+	long kept;
+
+	retire_frame();
+	cache_store_view();
+	kept = unzoom_pixels(ox, oy);
+	printf("kept %ld of %d pixels from the previous view\n", kept, width * height);
+
+	/* ox and oy have the parity of the old position, the new one is exact */
+	view_level--;
+	view_x = (view_x - ox) / 2;
+	view_y = (view_y - oy) / 2;
+
+	cache_load_view();
+	submit_frame();
+}
+
+void submit_frame(void) {
+	render* rn = malloc(sizeof *rn);
+	frame* f = &rn->f;
+	double prev_ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &frame_start);
+	atomic_store(&mpfr_allocs, 0);
+	atomic_store(&glitch_refs, 0);
+	atomic_store(&filled_pixels, 0);
+	atomic_store(&bulb_pixels, 0);
+	atomic_store(&periodic_pixels, 0);
+	atomic_store(&interior_pixels, 0);
+
+	frame_stored = 0;
+
+	pthread_mutex_lock(&done_mutex);
+	prev_ms = last_frame_ms;
+	pthread_mutex_unlock(&done_mutex);
+
+	/* snapshot the view and pick the cheapest precision able to resolve it */
+	frame_init(f, bound_left, bound_right, bound_top, bound_bottom, width, height, perturbation, periodicity, max_iterations);
+	atomic_init(&rn->refs, 0);
+
+	printf("rendering with %s precision (%ld bits required)\n", tier_name(f->tier), f->bits);
+	if (f->tier == TIER_PERTURB) printf("series approximation skips %d of %d reference iterations\n", f->sa.skip, f->ref.len);
+
+	/* only refine progressively when a single pass would keep the screen blank for a while */
+	current_render = rn;
+	current_pass = progressive && (f->tier >= TIER_DDOUBLE || prev_ms > PROGRESSIVE_MS) ? 0 : PASSES - 1;
+
+	submit_pass();
+}
+
+void submit_pass(void) {
+	frame_pass* p = malloc(sizeof *p);
+	int count = 0;
+
+	p->r = current_render;
+	p->stride = pass_strides[current_pass];
+	p->last = current_pass == PASSES - 1;
+	atomic_fetch_add(&p->r->refs, 1);
+
+	/* from here on only this pass may report, a retired one finishing late is ignored by frame_done */
+	pthread_mutex_lock(&done_mutex);
+	p->id = ++submitted_pass;
+	frame_finished = 0;
+	pthread_mutex_unlock(&done_mutex);
+
+	/* workers only iterate the blank pixels of a tile, tiles without any are skipped entirely */
+	for (int i = 0; i < num_tiles; ++i) {
+		const tile* t = tiles + i;
+		int blank = 0;
+
+		for (int y = t->bottom; y <= t->top && !blank; ++y) {
+			for (int x = t->left; x <= t->right && !blank; ++x) {
+				blank = iterbuf[y * width + x] < 0;
+			}
 		}
+
+		if (blank) pending_tiles[count++] = *t;
+	}
+
+	if (count < num_tiles && p->last) printf("reusing %d of %d tiles\n", num_tiles - count, num_tiles);
+
+	pool_submit(pending_tiles, count, p);
+
+	/* the pool never finishes an empty batch */
+	if (!count) frame_done(p);
+}
+
+int advance_frame(void) {
+	if (!current_render || atomic_load(&finished_pass) != submitted_pass) return 0;
+
+	if (current_pass == PASSES - 1) {
+		/* no worker writes iterbuf until the next view */
+		if (!frame_stored) cache_store_view();
+		frame_stored = 1;
+
+		return 1;
+	}
+
+	current_pass++;
+	submit_pass();
+
+	return 0;
+}
+
+void run_tile(int worker, const tile* t, void* ctx, unsigned gen) {
+	const frame_pass* p = ctx;
+	const frame* f = &p->r->f;
+
+	scratch_prepare(scratch + worker, f->prec);
+	tile_buffer_prepare(buffers + worker, (1 + t->right - t->left) * (1 + t->top - t->bottom));
+
+	if (p->stride > 1) {
+		compute_coarse(f, scratch + worker, buffers + worker, gen, p->stride, t->left, t->right, t->top, t->bottom);
+	} else {
+		compute_mandelbrot_sub(f, scratch + worker, buffers + worker, gen, t->left, t->right, t->top, t->bottom);
+	}
+}
+
+void tile_buffer_prepare(tile_buffer* b, int size) {
+	if (size <= b->cap) return;
+
+	b->cap = size;
+	b->counts = realloc(b->counts, size * sizeof *b->counts);
+	b->work = realloc(b->work, 2 * size * sizeof *b->work);
+}
+
+void frame_done(void* ctx) {
+	const frame_pass* p = ctx;
+	struct timespec now;
+	long interior = atomic_load(&interior_pixels);
+	double ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (now.tv_sec - frame_start.tv_sec) * 1e3 + (now.tv_nsec - frame_start.tv_nsec) / 1e6;
+
+	/*
+	 * a worker can pass the generation check just before its batch is retired and get here after a newer
+	 * pass was submitted, or even finished. only the pass submitted last may report
+	 */
+	pthread_mutex_lock(&done_mutex);
+
+	if (p->id != submitted_pass) {
+		pthread_mutex_unlock(&done_mutex);
+		return;
+	}
+
+	if (p->last) {
+		printf("frame finished in %.1f ms with %ld mpfr allocations, %d glitch references, %ld pixels filled by subdivision and %ld rejected by the bulb test\n",
+			ms, atomic_load(&mpfr_allocs), atomic_load(&glitch_refs), atomic_load(&filled_pixels), atomic_load(&bulb_pixels));
+
+		if (interior) printf("periodicity check caught %ld of %ld iterated interior pixels (%.1f%%)\n",
+			atomic_load(&periodic_pixels), interior, 100.0 * atomic_load(&periodic_pixels) / interior);
+
+		frame_finished = 1;
+		last_frame_ms = ms;
+	} else {
+		printf("1/%d resolution pass finished after %.1f ms\n", p->stride, ms);
 	}
 
-	/* copy local pixbuf to main */
-	pthread_mutex_lock(&pixbuf_mutex);
+	atomic_store(&finished_pass, p->id);
+	pthread_cond_broadcast(&done_cond);
+	pthread_mutex_unlock(&done_mutex);
+
+	if (!p->last) wake_main_loop(); /* the main loop submits the next pass */
+}
+
+void wake_main_loop(void) {
+#ifndef MBR_HEADLESS
+	if (win) glfwPostEmptyEvent();
+#endif
+}
+
+void frame_release(void* ctx) {
+	frame_pass* p = ctx;
+
+	if (atomic_fetch_sub(&p->r->refs, 1) == 1) {
+		frame_clear(&p->r->f);
+		free(p->r);
+	}
+
+	free(p);
+}
+
+void compute_mandelbrot_sub(const frame* f, mpfr_scratch* s, tile_buffer* b, unsigned gen, int left, int right, int top, int bottom) {
+	int sect_width = 1 + right - left, sect_height = 1 + top - bottom;
+	int* counts = b->counts;
+	span_stats st = {0};
+
+	/*
+	 * pixels carried over from the previous view are kept, only blank ones are iterated.
+	 * iterbuf may be moved or reallocated once the frame is retired, so the read is announced like a write
+	 */
+	atomic_fetch_add(&publishing, 1);
+
+	if (pool_stale(gen)) {
+		atomic_fetch_sub(&publishing, 1);
+		return;
+	}
 
-	/* use memcpy per-row */
 	for (int y = bottom; y <= top; ++y) {
-		memcpy(pixbuf + y * WIDTH + left, temp_pixbuf + (y - bottom) * sect_width, sect_width * sizeof *temp_pixbuf);
+		const float* src = iterbuf + y * f->width + left;
+		int* row = counts + (y - bottom) * sect_width;
+
+		for (int x = 0; x < sect_width; ++x) {
+			row[x] = src[x] < 0 ? COUNT_PENDING : (int) src[x]; /* previews are recomputed too */
+		}
+	}
+
+	atomic_fetch_sub(&publishing, 1);
+
+	if (subdivide) {
+		subdivide_rect(f, s, gen, &st, counts, sect_width, left, bottom, 0, 0, sect_width, sect_height);
+	} else {
+		for (int y = bottom; y <= top; ++y) {
+			if (pool_stale(gen)) return; /* the view moved on, abandon the tile */
+			compute_pending(f, s, counts + (y - bottom) * sect_width, left, y, sect_width, &st);
+		}
+	}
+
+	atomic_fetch_add_explicit(&bulb_pixels, st.bulb, memory_order_relaxed);
+	atomic_fetch_add_explicit(&periodic_pixels, st.periodic, memory_order_relaxed);
+	atomic_fetch_add_explicit(&interior_pixels, st.interior, memory_order_relaxed);
+
+	/* re-render glitched perturbation pixels against references inside their own region */
+	if (pool_stale(gen)) return;
+	atomic_fetch_add(&glitch_refs, fix_glitches(f, s, counts, b->work, left, bottom, sect_width, sect_height));
+
+	/*
+	 * write the counts straight into the tile's own region of iterbuf, no other worker owns it.
+	 * the generation is checked after announcing the write, so retire_frame either stops us here or waits for us
+	 */
+	atomic_fetch_add(&publishing, 1);
+
+	if (!pool_stale(gen)) {
+		/* coloring is left to the fragment shader */
+		for (int y = bottom; y <= top; ++y) {
+			float* row = iterbuf + y * f->width + left;
+			const int* src = counts + (y - bottom) * sect_width;
+
+			for (int x = 0; x < sect_width; ++x) {
+				row[x] = src[x];
+			}
+		}
+
+		atomic_store_explicit(tile_dirty + (bottom / TILE_SIZE) * ((f->width + TILE_SIZE - 1) / TILE_SIZE) + left / TILE_SIZE, 1, memory_order_release);
+		wake_main_loop(); /* the main loop uploads it */
+	}
+
+	atomic_fetch_sub(&publishing, 1);
+}
+
+void compute_coarse(const frame* f, mpfr_scratch* s, tile_buffer* b, unsigned gen, int stride, int left, int right, int top, int bottom) {
+	int sect_width = 1 + right - left;
+	int* counts = b->counts;
+	span_stats st = {0};
+
+	/* samples sit on multiples of stride in screen coordinates, so every pass reuses the coarser ones */
+	atomic_fetch_add(&publishing, 1);
+
+	if (pool_stale(gen)) {
+		atomic_fetch_sub(&publishing, 1);
+		return;
+	}
+
+	for (int y = bottom; y <= top; y += stride) {
+		for (int x = left; x <= right; x += stride) {
+			counts[(y - bottom) * sect_width + x - left] = iterbuf[y * f->width + x] < 0 ? COUNT_PENDING : COUNT_KNOWN;
+		}
+	}
+
+	atomic_fetch_sub(&publishing, 1);
+
+	for (int y = bottom; y <= top; y += stride) {
+		if (pool_stale(gen)) return;
+
+		for (int x = left; x <= right; x += stride) {
+			int* c = counts + (y - bottom) * sect_width + x - left;
+			if (*c == COUNT_PENDING) compute_span(f, s, x, y, 1, c, &st);
+		}
+	}
+
+	atomic_fetch_add_explicit(&bulb_pixels, st.bulb, memory_order_relaxed);
+	atomic_fetch_add_explicit(&periodic_pixels, st.periodic, memory_order_relaxed);
+	atomic_fetch_add_explicit(&interior_pixels, st.interior, memory_order_relaxed);
+
+	atomic_fetch_add(&publishing, 1);
+
+	if (!pool_stale(gen)) {
+		/* each new sample previews the blank pixels of its block, glitched ones wait for the full pass */
+		for (int y = bottom; y <= top; y += stride) {
+			for (int x = left; x <= right; x += stride) {
+				int c = counts[(y - bottom) * sect_width + x - left];
+
+				if (c < 0) continue;
+
+				for (int j = y; j < y + stride && j <= top; ++j) {
+					for (int i = x; i < x + stride && i <= right; ++i) {
+						float* dst = iterbuf + j * f->width + i;
+						if (*dst < 0) *dst = ITER_PREVIEW(c);
+					}
+				}
+
+				iterbuf[y * f->width + x] = c;
+			}
+		}
+
+		atomic_store_explicit(tile_dirty + (bottom / TILE_SIZE) * ((f->width + TILE_SIZE - 1) / TILE_SIZE) + left / TILE_SIZE, 1, memory_order_release);
+		wake_main_loop();
+	}
+
+	atomic_fetch_sub(&publishing, 1);
+}
+
+void compute_pending(const frame* f, mpfr_scratch* s, int* row, int x, int y, int n, span_stats* st) {
+	for (int i = 0; i < n;) {
+		int j = i;
+
+		while (j < n && row[j] == COUNT_PENDING) ++j;
+
+		/* iterate whole runs so the span kernels still see long rows */
+		if (j > i) {
+			compute_span(f, s, x + i, y, j - i, row + i, st);
+			i = j;
+		} else {
+			++i;
+		}
+	}
+}
+
+void subdivide_rect(const frame* f, mpfr_scratch* s, unsigned gen, span_stats* st, int* counts, int stride, int left, int bottom, int x, int y, int w, int h) {
+	/* x, y are relative to the tile at (left, bottom); borders shared with the parent are already computed */
+	int* first = counts + y * stride + x;
+	int* last = counts + (y + h - 1) * stride + x;
+	int border, uniform = 1;
+
+	if (pool_stale(gen)) return;
+
+	compute_pending(f, s, first, left + x, bottom + y, w, st);
+	compute_pending(f, s, last, left + x, bottom + y + h - 1, w, st);
+
+	for (int j = 1; j < h - 1; ++j) {
+		compute_pending(f, s, first + j * stride, left + x, bottom + y + j, 1, st);
+		compute_pending(f, s, first + j * stride + w - 1, left + x + w - 1, bottom + y + j, 1, st);
+	}
+
+	border = *first;
+
+	for (int i = 0; i < w && uniform; ++i) {
+		uniform = first[i] == border && last[i] == border;
+	}
+
+	for (int j = 1; j < h - 1 && uniform; ++j) {
+		uniform = first[j * stride] == border && first[j * stride + w - 1] == border;
+	}
+
+	/* glitched pixels must be re-rendered, never spread over an interior */
+	if (uniform && border != PERTURB_GLITCH) {
+		long filled = 0;
+
+		/* pixels already known stay as they are */
+		for (int j = 1; j < h - 1; ++j) {
+			for (int i = 1; i < w - 1; ++i) {
+				if (first[j * stride + i] != COUNT_PENDING) continue;
+
+				first[j * stride + i] = border;
+				filled++;
+			}
+		}
+
+		atomic_fetch_add_explicit(&filled_pixels, filled, memory_order_relaxed);
+		return;
 	}
 
-	pthread_mutex_unlock(&pixbuf_mutex);
+	/* too small to be worth splitting, iterate what is left */
+	if (w * h <= SUBDIV_MIN_SIZE || w <= 2 || h <= 2) {
+		for (int j = 1; j < h - 1; ++j) {
+			compute_pending(f, s, first + j * stride + 1, left + x + 1, bottom + y + j, w - 2, st);
+		}
+
+		return;
+	}
+
+	/* split across the longer side, both halves sharing the middle line */
+	if (w >= h) {
+		int mid = w / 2;
+
+		subdivide_rect(f, s, gen, st, counts, stride, left, bottom, x, y, mid + 1, h);
+		subdivide_rect(f, s, gen, st, counts, stride, left, bottom, x + mid, y, w - mid, h);
+	} else {
+		int mid = h / 2;
+
+		subdivide_rect(f, s, gen, st, counts, stride, left, bottom, x, y, w, mid + 1);
+		subdivide_rect(f, s, gen, st, counts, stride, left, bottom, x, y + mid, w, h - mid);
+	}
 }
 
-pixel get_color(int ind) {
+pixel get_color(int ind, int max_iter) {
 	pixel output = {0};
-	int seg_size = MBR_MAX_ITERATIONS / 3;
+	int seg_size = max_iter / 3;
 
-	if (ind == MBR_MAX_ITERATIONS) return pix_black;
+	if (ind == max_iter) return pix_black;
 
 	/* transition to blue, green, and then red */
 	if (ind >= seg_size * 2) {
@@ -418,17 +1691,79 @@ pixel get_color(int ind) {
 	return output;
 }
 
+void build_palette(int index) {
+	for (int i = 0; i < PALETTE_SIZE; ++i) {
+		double t = (double) i / PALETTE_SIZE;
+		pixel p = { 0, 0, 0, 0xFF };
+
+		switch (index) {
+		case 0:
+			p = get_color(i, PALETTE_SIZE);
+			break;
+		case 1:
+			p.r = p.g = p.b = 0xFF * sqrt(t); /* lift the sparse high counts */
+			break;
+		case 2:
+			/* repeating bands keep deep views readable where every count lands near the top */
+			p.r = 0x7F + 0x7F * cos(TAU * (8 * t));
+			p.g = 0x7F + 0x7F * cos(TAU * (8 * t + 0.33));
+			p.b = 0x7F + 0x7F * cos(TAU * (8 * t + 0.67));
+			break;
+		}
+
+		palette[i] = p;
+	}
+}
+
+void upload_palette(void) {
+#ifndef MBR_HEADLESS
+	glActiveTexture(GL_TEXTURE1);
+	glTexSubImage1D(GL_TEXTURE_1D, 0, 0, PALETTE_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, palette);
+	glActiveTexture(GL_TEXTURE0);
+#endif
+}
+
+pixel shade(float it, int max_iter) {
+	int ind;
+
+	if (it < -1.5f) it = ITER_PREVIEW(it);
+	if (it < 0) return pix_white;
+	if (it >= max_iter) return pix_black;
+
+	/* same texel a nearest lookup at it / max_iter picks */
+	ind = it * PALETTE_SIZE / max_iter;
+	return palette[ind < PALETTE_SIZE ? ind : PALETTE_SIZE - 1];
+}
+
+#ifndef MBR_HEADLESS
 void key_callback(GLFWwindow* win, int key, int scancode, int action, int mods) {
-	if (action != GLFW_PRESS) return;
+	if (action == GLFW_PRESS) navigate(key);
+}
+#endif
+
+void navigate(int key) {
+	mpfr_t next_bl, next_br, next_bb, next_bt, hdiff, vdiff, hpan, vpan;
+	int dx = 0, dy = 0, zoom = 0, ox = 0, oy = 0, keep = 0;
+	long prec = required_bits(bound_left, bound_right, bound_top, bound_bottom, width, height) + MPFR_PREC_STEP;
+
+	/* keep the bounds exact for at least one more zoom step */
+	if (prec > mpfr_get_prec(bound_left)) {
+		mpfr_prec_round(bound_left, prec, MPFR_RNDD);
+		mpfr_prec_round(bound_right, prec, MPFR_RNDD);
+		mpfr_prec_round(bound_top, prec, MPFR_RNDD);
+		mpfr_prec_round(bound_bottom, prec, MPFR_RNDD);
+	}
 
-	mpfr_t next_bl, next_br, next_bb, next_bt, hdiff, vdiff;
+	prec = mpfr_get_prec(bound_left);
 
-	mpfr_init2(next_bl, PBITS);
-	mpfr_init2(next_br, PBITS);
-	mpfr_init2(next_bb, PBITS);
-	mpfr_init2(next_bt, PBITS);
-	mpfr_init2(hdiff, PBITS);
-	mpfr_init2(vdiff, PBITS);
+	mpfr_init2(next_bl, prec);
+	mpfr_init2(next_br, prec);
+	mpfr_init2(next_bb, prec);
+	mpfr_init2(next_bt, prec);
+	mpfr_init2(hdiff, prec);
+	mpfr_init2(vdiff, prec);
+	mpfr_init2(hpan, prec);
+	mpfr_init2(vpan, prec);
 
 	mpfr_set(next_bl, bound_left, MPFR_RNDD);
 	mpfr_set(next_br, bound_right, MPFR_RNDD);
@@ -438,41 +1773,113 @@ void key_callback(GLFWwindow* win, int key, int scancode, int action, int mods)
 	mpfr_sub(hdiff, bound_right, bound_left, MPFR_RNDD);
 	mpfr_sub(vdiff, bound_top, bound_bottom, MPFR_RNDD);
 
+	/* pans move by a whole number of pixels, about half the screen, so the rest of the old frame lines up */
+	mpfr_mul_si(hpan, hdiff, width / 2, MPFR_RNDD);
+	mpfr_div_si(hpan, hpan, width - 1, MPFR_RNDD);
+	mpfr_mul_si(vpan, vdiff, height / 2, MPFR_RNDD);
+	mpfr_div_si(vpan, vpan, height - 1, MPFR_RNDD);
+
 	mpfr_div_d(hdiff, hdiff, 2.0, MPFR_RNDD);
 	mpfr_div_d(vdiff, vdiff, 2.0, MPFR_RNDD);
 
 	switch (key) {
 	case GLFW_KEY_LEFT:
-		mpfr_sub(next_bl, bound_left, hdiff, MPFR_RNDD);
-		mpfr_sub(next_br, bound_right, hdiff, MPFR_RNDD);
+		mpfr_sub(next_bl, bound_left, hpan, MPFR_RNDD);
+		mpfr_sub(next_br, bound_right, hpan, MPFR_RNDD);
+		dx = -(width / 2);
 		break;
 	case GLFW_KEY_RIGHT:
-		mpfr_add(next_bl, bound_left, hdiff, MPFR_RNDD);
-		mpfr_add(next_br, bound_right, hdiff, MPFR_RNDD);
+		mpfr_add(next_bl, bound_left, hpan, MPFR_RNDD);
+		mpfr_add(next_br, bound_right, hpan, MPFR_RNDD);
+		dx = width / 2;
 		break;
 	case GLFW_KEY_UP:
-		mpfr_add(next_bb, bound_bottom, vdiff, MPFR_RNDD);
-		mpfr_add(next_bt, bound_top, vdiff, MPFR_RNDD);
+		mpfr_add(next_bb, bound_bottom, vpan, MPFR_RNDD);
+		mpfr_add(next_bt, bound_top, vpan, MPFR_RNDD);
+		dy = height / 2;
 		break;
 	case GLFW_KEY_DOWN:
-		mpfr_sub(next_bb, bound_bottom, vdiff, MPFR_RNDD);
-		mpfr_sub(next_bt, bound_top, vdiff, MPFR_RNDD);
+		mpfr_sub(next_bb, bound_bottom, vpan, MPFR_RNDD);
+		mpfr_sub(next_bt, bound_top, vpan, MPFR_RNDD);
+		dy = -(height / 2);
 		break;
 	case GLFW_KEY_SPACE:
-		/* zoom in 2x */
-		mpfr_div_d(hdiff, hdiff, 2.0, MPFR_RNDD);
-		mpfr_div_d(vdiff, vdiff, 2.0, MPFR_RNDD);
-		mpfr_add(next_bl, bound_left, hdiff, MPFR_RNDD);
-		mpfr_sub(next_br, bound_right, hdiff, MPFR_RNDD);
-		mpfr_add(next_bb, bound_bottom, vdiff, MPFR_RNDD);
-		mpfr_sub(next_bt, bound_top, vdiff, MPFR_RNDD);
+		/*
+		 * zoom in 2x about the center, rounded so the new left and bottom edges land on an old pixel.
+		 * every other new pixel then coincides with one already computed
+		 */
+		mpfr_mul_si(hpan, hdiff, 2 * ((width - 1) / 4), MPFR_RNDD);
+		mpfr_div_si(hpan, hpan, width - 1, MPFR_RNDD);
+		mpfr_add(next_bl, bound_left, hpan, MPFR_RNDD);
+		mpfr_add(next_br, next_bl, hdiff, MPFR_RNDD);
+
+		mpfr_mul_si(vpan, vdiff, 2 * ((height - 1) / 4), MPFR_RNDD);
+		mpfr_div_si(vpan, vpan, height - 1, MPFR_RNDD);
+		mpfr_add(next_bb, bound_bottom, vpan, MPFR_RNDD);
+		mpfr_add(next_bt, next_bb, vdiff, MPFR_RNDD);
+
+		zoom = 1;
+		break;
+	case GLFW_KEY_BACKSPACE:
+		/* zoom out 2x, the inverse of SPACE, stepping a pixel aside when the lattice position is odd */
+		ox = 2 * ((width - 1) / 4) + (int) (view_x - 2 * floor_div(view_x, 2));
+		oy = 2 * ((height - 1) / 4) + (int) (view_y - 2 * floor_div(view_y, 2));
+
+		mpfr_mul_si(hpan, hdiff, 2 * ox, MPFR_RNDD);
+		mpfr_div_si(hpan, hpan, width - 1, MPFR_RNDD);
+		mpfr_sub(next_bl, bound_left, hpan, MPFR_RNDD);
+		mpfr_mul_2ui(hpan, hdiff, 2, MPFR_RNDD);
+		mpfr_add(next_br, next_bl, hpan, MPFR_RNDD);
+
+		mpfr_mul_si(vpan, vdiff, 2 * oy, MPFR_RNDD);
+		mpfr_div_si(vpan, vpan, height - 1, MPFR_RNDD);
+		mpfr_sub(next_bb, bound_bottom, vpan, MPFR_RNDD);
+		mpfr_mul_2ui(vpan, vdiff, 2, MPFR_RNDD);
+		mpfr_add(next_bt, next_bb, vpan, MPFR_RNDD);
+
+		zoom = -1;
+		break;
+	case GLFW_KEY_P:
+		perturbation = !perturbation;
+		printf("perturbation %s\n", perturbation ? "enabled" : "disabled");
+		break;
+	case GLFW_KEY_LEFT_BRACKET:
+		periodicity /= 2;
+		printf("periodicity window %d%s\n", periodicity, periodicity ? "" : " (disabled)");
 		break;
+	case GLFW_KEY_RIGHT_BRACKET:
+		periodicity = periodicity ? periodicity * 2 : 1;
+		if (periodicity > max_iterations) periodicity = max_iterations;
+		printf("periodicity window %d\n", periodicity);
+		break;
+	case GLFW_KEY_M:
+		subdivide = !subdivide;
+		printf("subdivision %s\n", subdivide ? "enabled" : "disabled");
+		break;
+	case GLFW_KEY_G:
+		progressive = !progressive;
+		printf("progressive refinement %s\n", progressive ? "enabled" : "disabled");
+		keep = 1; /* the counts do not depend on it, only the blank pixels are picked up again */
+		break;
+	case GLFW_KEY_C:
+		/* only the palette texture changes, the iteration counts stay */
+		palette_index = (palette_index + 1) % NUM_PALETTES;
+		build_palette(palette_index);
+		upload_palette();
+		redraw = 1;
+		printf("%s palette\n", palette_names[palette_index]);
+
+		/* nothing to recompute */
+		/* fall through */
 	default:
 		mpfr_clear(next_bl);
 		mpfr_clear(next_br);
 		mpfr_clear(next_bb);
+		mpfr_clear(next_bt);
 		mpfr_clear(hdiff);
 		mpfr_clear(vdiff);
+		mpfr_clear(hpan);
+		mpfr_clear(vpan);
 		return;
 	}
 
@@ -484,9 +1891,19 @@ void key_callback(GLFWwindow* win, int key, int scancode, int action, int mods)
 	mpfr_clear(next_bl);
 	mpfr_clear(next_br);
 	mpfr_clear(next_bb);
+	mpfr_clear(next_bt);
 	mpfr_clear(hdiff);
 	mpfr_clear(vdiff);
-
-	flush_pixels(pix_white);
-	start_mandelbrot();
+	mpfr_clear(hpan);
+	mpfr_clear(vpan);
+
+	if (zoom > 0) {
+		zoom_mandelbrot((width - 1) / 4, (height - 1) / 4);
+	} else if (zoom < 0) {
+		unzoom_mandelbrot(ox, oy);
+	} else if (dx || dy || keep) {
+		shift_mandelbrot(dx, dy);
+	} else {
+		start_mandelbrot();
+	}
 }
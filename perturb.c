@@ -0,0 +1,251 @@
+/*
+ * perturbation : the reference orbit Z is iterated once in mpfr, every other pixel only tracks
+ * its offset dz from Z, which stays small enough for doubles long after c itself needs hundreds of bits
+ *
+ * pixels whose orbit passes too close to Z lose the precision of dz and would come out as flat blobs.
+ * they are flagged as glitched and re-iterated against a new reference picked inside each glitched region
+ *
+ * the early part of every orbit is nearly the same polynomial in dc, so a cubic series fitted along the
+ * reference lets pixels against the primary reference start deep into the orbit instead of at zero
+ */
+
+#include <stdlib.h>
+
+#include "kernel.h"
+#include "perturb.h"
+
+#define PERTURB_REAL double
+#define PERTURB_NAME perturb_d
+#define PERTURB_ZR zr_d
+#define PERTURB_ZI zi_d
+#include "perturb_real.h"
+
+#define PERTURB_REAL long double
+#define PERTURB_NAME perturb_ld
+#define PERTURB_ZR zr_ld
+#define PERTURB_ZI zi_ld
+#include "perturb_real.h"
+
+/*
+ * long double value of x as the sum of two doubles. mpfr_get_ld allocates a temporary on every call,
+ * this only needs tmp, which must hold at least the precision of x so the remainder is exact
+ */
+static long double get_ld(mpfr_t x, mpfr_t tmp) {
+	double hi = mpfr_get_d(x, MPFR_RNDD);
+
+	mpfr_sub_d(tmp, x, hi, MPFR_RNDD);
+	return (long double) hi + mpfr_get_d(tmp, MPFR_RNDD);
+}
+
+void ref_orbit_init(ref_orbit* o, mpfr_scratch* s, int max_iter) {
+	o->max_iter = max_iter;
+	o->zr_d = malloc(max_iter * sizeof *o->zr_d);
+	o->zi_d = malloc(max_iter * sizeof *o->zi_d);
+	o->zr_ld = malloc(max_iter * sizeof *o->zr_ld);
+	o->zi_ld = malloc(max_iter * sizeof *o->zi_ld);
+
+	mpfr_set_d(s->cur_r, 0.0, MPFR_RNDD);
+	mpfr_set_d(s->cur_i, 0.0, MPFR_RNDD);
+
+	for (o->len = 0; o->len < max_iter; ) {
+		o->zr_d[o->len] = mpfr_get_d(s->cur_r, MPFR_RNDD);
+		o->zi_d[o->len] = mpfr_get_d(s->cur_i, MPFR_RNDD);
+		o->zr_ld[o->len] = get_ld(s->cur_r, s->dist); /* dist is free until the next step */
+		o->zi_ld[o->len] = get_ld(s->cur_i, s->dist);
+		o->len++;
+
+		mpfr_mul(s->dist, s->cur_r, s->cur_r, MPFR_RNDD);
+		mpfr_mul(s->dist2, s->cur_i, s->cur_i, MPFR_RNDD);
+		mpfr_add(s->rt, s->dist, s->dist2, MPFR_RNDD);
+
+		if (mpfr_cmp_d(s->rt, MBR_DIVERGE_THRESHOLD) >= 0) break;
+
+		mpfr_sub(s->rt, s->dist, s->dist2, MPFR_RNDD);
+		mpfr_add(s->rt, s->rt, s->inp_r, MPFR_RNDD);
+
+		mpfr_mul(s->cur_i, s->cur_r, s->cur_i, MPFR_RNDD);
+		mpfr_mul_2ui(s->cur_i, s->cur_i, 1, MPFR_RNDD);
+		mpfr_add(s->cur_i, s->cur_i, s->inp_i, MPFR_RNDD);
+		mpfr_swap(s->cur_r, s->rt);
+	}
+}
+
+void ref_orbit_clear(ref_orbit* o) {
+	free(o->zr_d);
+	free(o->zi_d);
+	free(o->zr_ld);
+	free(o->zi_ld);
+}
+
+void series_init(frame* f) {
+	const ref_orbit* o = &f->ref;
+	const int probe_x[4] = { 0, f->width - 1, 0, f->width - 1 }, probe_y[4] = { 0, 0, f->height - 1, f->height - 1 };
+	long double ar = 0, ai = 0, br = 0, bi = 0, cr = 0, ci = 0, d2 = 0;
+	long double dcr[4], dci[4], dzr[4], dzi[4];
+
+	f->sa.skip = 0;
+	f->sa.ar = f->sa.ai = f->sa.br = f->sa.bi = f->sa.cr = f->sa.ci = 0;
+
+	/* the corners are the pixels farthest from the reference, if the series holds there it holds everywhere */
+	for (int k = 0; k < 4; ++k) {
+		dcr[k] = f->step_x_ld * (probe_x[k] - o->x);
+		dci[k] = f->step_y_ld * (probe_y[k] - o->y);
+		dzr[k] = dzi[k] = 0;
+
+		if (dcr[k] * dcr[k] + dci[k] * dci[k] > d2) d2 = dcr[k] * dcr[k] + dci[k] * dci[k];
+	}
+
+	for (int n = 0; n + 1 < o->len; ++n) {
+		long double zr = o->zr_ld[n], zi = o->zi_ld[n], nar, nai, nbr, nbi, ncr, nci, t;
+		int valid = 1;
+
+		/* A' = 2ZA + 1, B' = 2ZB + A^2, C' = 2ZC + 2AB */
+		nar = 2 * (zr * ar - zi * ai) + 1;
+		nai = 2 * (zr * ai + zi * ar);
+		nbr = 2 * (zr * br - zi * bi) + ar * ar - ai * ai;
+		nbi = 2 * (zr * bi + zi * br) + 2 * ar * ai;
+		ncr = 2 * (zr * cr - zi * ci) + 2 * (ar * br - ai * bi);
+		nci = 2 * (zr * ci + zi * cr) + 2 * (ar * bi + ai * br);
+
+		/* the dropped terms must stay negligible, judged by |C| d^3 against |B| d^2 */
+		if ((ncr * ncr + nci * nci) * d2 > SA_TOLERANCE * SA_TOLERANCE * (nbr * nbr + nbi * nbi)) break;
+
+		for (int k = 0; k < 4; ++k) {
+			long double sr, si, er, ei;
+
+			/* exact delta step for the probe */
+			t = (2 * zr + dzr[k]) * dzr[k] - (2 * zi + dzi[k]) * dzi[k] + dcr[k];
+			dzi[k] = (2 * zr + dzr[k]) * dzi[k] + (2 * zi + dzi[k]) * dzr[k] + dci[k];
+			dzr[k] = t;
+
+			/* series estimate, ((C dc + B) dc + A) dc */
+			sr = ncr * dcr[k] - nci * dci[k] + nbr;
+			si = ncr * dci[k] + nci * dcr[k] + nbi;
+			t = sr * dcr[k] - si * dci[k] + nar;
+			si = sr * dci[k] + si * dcr[k] + nai;
+			sr = t * dcr[k] - si * dci[k];
+			si = t * dci[k] + si * dcr[k];
+
+			er = sr - dzr[k];
+			ei = si - dzi[k];
+
+			if (er * er + ei * ei > SA_TOLERANCE * SA_TOLERANCE * (dzr[k] * dzr[k] + dzi[k] * dzi[k])) valid = 0;
+
+			/* a probe that escapes would have needed the iterations we are about to skip */
+			t = (o->zr_ld[n + 1] + dzr[k]) * (o->zr_ld[n + 1] + dzr[k]) + (o->zi_ld[n + 1] + dzi[k]) * (o->zi_ld[n + 1] + dzi[k]);
+			if (t >= MBR_DIVERGE_THRESHOLD) valid = 0;
+		}
+
+		if (!valid) break;
+
+		ar = nar;
+		ai = nai;
+		br = nbr;
+		bi = nbi;
+		cr = ncr;
+		ci = nci;
+
+		f->sa.skip = n + 1;
+		f->sa.ar = ar;
+		f->sa.ai = ai;
+		f->sa.br = br;
+		f->sa.bi = bi;
+		f->sa.cr = cr;
+		f->sa.ci = ci;
+	}
+}
+
+int perturb_pixel(const frame* f, const ref_orbit* o, int x, int y) {
+	long double dcr = f->step_x_ld * (x - o->x), dci = f->step_y_ld * (y - o->y), dzr = 0, dzi = 0, sr, si, t;
+	int n = 0;
+
+	/* only the primary reference has a series */
+	if (o == &f->ref && f->sa.skip) {
+		sr = f->sa.cr * dcr - f->sa.ci * dci + f->sa.br;
+		si = f->sa.cr * dci + f->sa.ci * dcr + f->sa.bi;
+		t = sr * dcr - si * dci + f->sa.ar;
+		si = sr * dci + si * dcr + f->sa.ai;
+		dzr = t * dcr - si * dci;
+		dzi = t * dci + si * dcr;
+		n = f->sa.skip;
+	}
+
+	if (f->ref_ld) {
+		return perturb_ld(o, dcr, dci, n, dzr, dzi);
+	}
+
+	return perturb_d(o, f->step_x_d * (x - o->x), f->step_y_d * (y - o->y), n, dzr, dzi);
+}
+
+int fix_glitches(const frame* f, mpfr_scratch* s, int* counts, int* work, int left, int bottom, int width, int height) {
+	int refs = 0, size = width * height, *blob = work, *stack = work + size;
+
+	if (f->tier != TIER_PERTURB) return 0;
+
+	for (int start = 0; start < size; ++start) {
+		int blob_size = 0, top = 0, best = start;
+		long sum_x = 0, sum_y = 0, best_dist = -1;
+		ref_orbit o;
+
+		if (counts[start] != PERTURB_GLITCH) continue;
+
+		if (refs == GLITCH_MAX_REFS) {
+			/* out of references, the remaining glitches are rare enough to pay for full precision */
+			for (int i = start; i < size; ++i) {
+				if (counts[i] == PERTURB_GLITCH) counts[i] = iterate_mpfr(f, s, left + i % width, bottom + i / width);
+			}
+			break;
+		}
+
+		/* flood fill the 4-connected glitched region containing this pixel */
+		stack[top++] = start;
+		counts[start] = PERTURB_GLITCH - 1; /* mark as queued */
+
+		while (top) {
+			int i = stack[--top], x = i % width, y = i / width;
+			int next[4] = { x > 0 ? i - 1 : -1, x < width - 1 ? i + 1 : -1, y > 0 ? i - width : -1, y < height - 1 ? i + width : -1 };
+
+			blob[blob_size++] = i;
+			sum_x += x;
+			sum_y += y;
+
+			for (int k = 0; k < 4; ++k) {
+				if (next[k] >= 0 && counts[next[k]] == PERTURB_GLITCH) {
+					counts[next[k]] = PERTURB_GLITCH - 1;
+					stack[top++] = next[k];
+				}
+			}
+		}
+
+		/* the new reference is the region pixel closest to the region's centroid */
+		for (int k = 0; k < blob_size; ++k) {
+			long dx = (blob[k] % width) * blob_size - sum_x, dy = (blob[k] / width) * blob_size - sum_y;
+
+			if (best_dist < 0 || dx * dx + dy * dy < best_dist) {
+				best_dist = dx * dx + dy * dy;
+				best = blob[k];
+			}
+		}
+
+		o.x = left + best % width;
+		o.y = bottom + best / width;
+
+		mpfr_mul_si(s->inp_r, f->step_x, o.x, MPFR_RNDD);
+		mpfr_add(s->inp_r, s->inp_r, f->left, MPFR_RNDD);
+		mpfr_mul_si(s->inp_i, f->step_y, o.y, MPFR_RNDD);
+		mpfr_add(s->inp_i, s->inp_i, f->bottom, MPFR_RNDD);
+
+		ref_orbit_init(&o, s, f->max_iter);
+		refs++;
+
+		/* the reference pixel itself always resolves, others still glitched are picked up by a later scan */
+		for (int k = 0; k < blob_size; ++k) {
+			counts[blob[k]] = perturb_pixel(f, &o, left + blob[k] % width, bottom + blob[k] / width);
+		}
+
+		ref_orbit_clear(&o);
+		start--; /* rescan from the same pixel in case it is still glitched */
+	}
+
+	return refs;
+}
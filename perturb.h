@@ -0,0 +1,44 @@
+#pragma once
+
+/*
+ * perturbation : one high-precision reference orbit per frame, per-pixel deltas in hardware floats
+ */
+
+#include <gmp.h>
+#include <mpfr.h>
+
+#define PERTURB_GLITCH -1 /* the delta lost precision or outlived the reference orbit, rebase the pixel */
+
+#define GLITCH_TOLERANCE 1e-6 /* pauldelbrot criterion: glitched once |Z + dz|^2 < tol * |Z|^2 */
+#define GLITCH_MAX_REFS 32 /* secondary references tried per region before falling back to mpfr */
+
+#define SA_TOLERANCE 1e-9 /* relative error allowed between the series and the exact delta at the probe points */
+
+/* types */
+
+typedef struct _ref_orbit {
+	int x, y; /* pixel the orbit was computed for */
+	int len; /* number of stored iterates, the last one may already have escaped */
+	int max_iter; /* iteration cap of the frame the orbit belongs to */
+	double *zr_d, *zi_d;
+	long double *zr_ld, *zi_ld; /* same orbit, used when the deltas underflow a double */
+} ref_orbit;
+
+/* truncated series dz_n = A dc + B dc^2 + C dc^3, valid for every pixel of the frame up to iteration skip */
+typedef struct _series {
+	int skip;
+	long double ar, ai, br, bi, cr, ci;
+} series;
+
+struct _frame;
+struct _mpfr_scratch;
+
+/* decls */
+
+void ref_orbit_init(ref_orbit* o, struct _mpfr_scratch* s, int max_iter); /* orbit of the point held in s->inp_r, s->inp_i */
+void ref_orbit_clear(ref_orbit* o);
+int perturb_d(const ref_orbit* o, double dcr, double dci, int n, double dzr, double dzi); /* resumes at iteration n with delta dz */
+int perturb_ld(const ref_orbit* o, long double dcr, long double dci, int n, long double dzr, long double dzi);
+void series_init(struct _frame* f);
+int perturb_pixel(const struct _frame* f, const ref_orbit* o, int x, int y);
+int fix_glitches(const struct _frame* f, struct _mpfr_scratch* s, int* counts, int* work, int left, int bottom, int width, int height); /* work holds 2 * width * height ints, returns the number of references used */
@@ -0,0 +1,36 @@
+/*
+ * delta iteration against a reference orbit for a native floating point type
+ * included by perturb.c once per type, with PERTURB_REAL, PERTURB_NAME, PERTURB_ZR and PERTURB_ZI defined
+ */
+
+int PERTURB_NAME(const ref_orbit* o, PERTURB_REAL dcr, PERTURB_REAL dci, int n, PERTURB_REAL dzr, PERTURB_REAL dzi) {
+	const PERTURB_REAL* ref_r = o->PERTURB_ZR;
+	const PERTURB_REAL* ref_i = o->PERTURB_ZI;
+	PERTURB_REAL zr, zi, ar, ai, t, mag;
+
+	for (; n < o->max_iter; ++n) {
+		if (n >= o->len) return PERTURB_GLITCH;
+
+		zr = ref_r[n] + dzr;
+		zi = ref_i[n] + dzi;
+		mag = zr * zr + zi * zi;
+
+		if (mag >= MBR_DIVERGE_THRESHOLD) break;
+		if (mag < GLITCH_TOLERANCE * (ref_r[n] * ref_r[n] + ref_i[n] * ref_i[n])) return PERTURB_GLITCH;
+
+		/* dz' = (2Z + dz) dz + dc */
+		ar = 2 * ref_r[n] + dzr;
+		ai = 2 * ref_i[n] + dzi;
+
+		t = ar * dzr - ai * dzi + dcr;
+		dzi = ar * dzi + ai * dzr + dci;
+		dzr = t;
+	}
+
+	return n;
+}
+
+#undef PERTURB_REAL
+#undef PERTURB_NAME
+#undef PERTURB_ZR
+#undef PERTURB_ZI
@@ -0,0 +1,225 @@
+/*
+ * work-stealing tile scheduler
+ * each worker owns a deque, popping its own tiles from the tail while thieves take from the head,
+ * so a worker stuck on the expensive interior keeps its neighbours' tiles flowing to idle workers
+ *
+ * a batch's context is reference counted: the pool holds one reference while the batch is current and
+ * every tile in flight holds another, so retiring a batch never waits for the workers
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "sched.h"
+
+/* types */
+
+typedef struct _batch {
+	void* ctx;
+	unsigned gen;
+	atomic_int refs;
+	atomic_int remaining; /* tiles not yet finished */
+} batch;
+
+typedef struct _entry {
+	tile t;
+	batch* b;
+} entry;
+
+typedef struct _deque {
+	pthread_mutex_t mutex;
+	entry* entries;
+	int head, tail, cap; /* owner pops at tail, thieves steal at head */
+} deque;
+
+/* globals */
+
+static int num_workers;
+static pthread_t* workers;
+static deque* deques;
+
+static tile_func run_tile;
+static void (*batch_done)(void* ctx);
+static void (*batch_release)(void* ctx);
+
+static batch* current; /* only touched by the submitting thread */
+static atomic_uint generation;
+static atomic_int queued; /* tiles sitting in any deque */
+static int quit;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER; /* signalled when tiles are queued or on shutdown */
+
+/* defs */
+
+static void unref(batch* b) {
+	if (atomic_fetch_sub(&b->refs, 1) == 1) {
+		if (batch_release) batch_release(b->ctx);
+		free(b);
+	}
+}
+
+static int take(int self, entry* out) {
+	for (int k = 0; k < num_workers; ++k) {
+		deque* d = deques + (self + k) % num_workers;
+		int found = 0;
+
+		pthread_mutex_lock(&d->mutex);
+
+		if (d->head < d->tail) {
+			*out = k ? d->entries[d->head++] : d->entries[--d->tail]; /* steal the oldest, pop our newest */
+			atomic_fetch_add(&out->b->refs, 1); /* the batch cannot be retired while we hold the deque lock */
+			atomic_fetch_sub(&queued, 1);
+			found = 1;
+		}
+
+		pthread_mutex_unlock(&d->mutex);
+
+		if (found) return 1;
+	}
+
+	return 0;
+}
+
+static void* worker_main(void* arg) {
+	int self = (int) (intptr_t) arg;
+	entry e;
+
+	for (;;) {
+		if (take(self, &e)) {
+			if (!pool_stale(e.b->gen)) {
+				run_tile(self, &e.t, e.b->ctx, e.b->gen);
+
+				if (atomic_fetch_sub(&e.b->remaining, 1) == 1 && !pool_stale(e.b->gen) && batch_done) batch_done(e.b->ctx);
+			}
+
+			unref(e.b);
+			continue;
+		}
+
+		pthread_mutex_lock(&pool_mutex);
+		while (!quit && !atomic_load(&queued)) pthread_cond_wait(&work_cond, &pool_mutex);
+		pthread_mutex_unlock(&pool_mutex);
+
+		if (quit) break;
+	}
+
+	return NULL;
+}
+
+void pool_init(tile_func run, void (*done)(void* ctx), void (*release)(void* ctx)) {
+	run_tile = run;
+	batch_done = done;
+	batch_release = release;
+
+	num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_workers < 1) num_workers = 1;
+
+	workers = malloc(num_workers * sizeof *workers);
+	deques = calloc(num_workers, sizeof *deques);
+
+	for (int i = 0; i < num_workers; ++i) {
+		pthread_mutex_init(&deques[i].mutex, NULL);
+	}
+
+	printf("spawning %d worker threads\n", num_workers);
+
+	for (int i = 0; i < num_workers; ++i) {
+		if (pthread_create(workers + i, NULL, worker_main, (void*) (intptr_t) i)) {
+			printf("failed to spawn thread..\n");
+			exit(10);
+		}
+	}
+}
+
+void pool_submit(const tile* tiles, int count, void* ctx) {
+	batch* b = malloc(sizeof *b);
+	batch* old = current;
+
+	b->ctx = ctx;
+	b->gen = atomic_fetch_add(&generation, 1) + 1; /* tiles already running notice this between rows */
+	atomic_init(&b->refs, 1);
+	atomic_init(&b->remaining, count);
+
+	/* deal out contiguous runs so each worker starts on a coherent region */
+	for (int i = 0; i < num_workers; ++i) {
+		deque* d = deques + i;
+		int first = count * i / num_workers, last = count * (i + 1) / num_workers;
+
+		pthread_mutex_lock(&d->mutex);
+
+		atomic_fetch_sub(&queued, d->tail - d->head); /* whatever was left of the old batch */
+
+		if (d->cap < last - first) {
+			d->cap = last - first;
+			d->entries = realloc(d->entries, d->cap * sizeof *d->entries);
+		}
+
+		/* stored reversed so the owner, popping from the tail, walks its run in order */
+		for (int k = first; k < last; ++k) {
+			d->entries[last - 1 - k].t = tiles[k];
+			d->entries[last - 1 - k].b = b;
+		}
+
+		d->head = 0;
+		d->tail = last - first;
+		atomic_fetch_add(&queued, last - first);
+
+		pthread_mutex_unlock(&d->mutex);
+	}
+
+	current = b;
+	if (old) unref(old);
+
+	pthread_mutex_lock(&pool_mutex);
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+void pool_cancel(void) {
+	atomic_fetch_add(&generation, 1);
+
+	for (int i = 0; i < num_workers; ++i) {
+		deque* d = deques + i;
+
+		pthread_mutex_lock(&d->mutex);
+		atomic_fetch_sub(&queued, d->tail - d->head);
+		d->head = d->tail = 0;
+		pthread_mutex_unlock(&d->mutex);
+	}
+
+	if (current) unref(current);
+	current = NULL;
+}
+
+void pool_destroy(void) {
+	pool_cancel();
+
+	pthread_mutex_lock(&pool_mutex);
+	quit = 1;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&pool_mutex);
+
+	/* workers drop their stale tile at the next row and release it on the way out */
+	for (int i = 0; i < num_workers; ++i) {
+		pthread_join(workers[i], NULL);
+		pthread_mutex_destroy(&deques[i].mutex);
+		free(deques[i].entries);
+	}
+
+	free(workers);
+	free(deques);
+}
+
+int pool_stale(unsigned gen) {
+	return atomic_load(&generation) != gen; /* sequentially consistent, callers pair it with their own counters */
+}
+
+int pool_size(void) {
+	return num_workers;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+/*
+ * persistent worker pool : tiles are dealt out to per-worker deques, idle workers steal from the others
+ * every batch gets a new generation number, tiles of older generations are dropped or abandoned by the
+ * workers themselves instead of the threads being cancelled
+ */
+
+/* types */
+
+typedef struct _tile {
+	int left, right, top, bottom; /* inclusive pixel bounds */
+} tile;
+
+typedef void (*tile_func)(int worker, const tile* t, void* ctx, unsigned gen);
+
+/* decls */
+
+void pool_init(tile_func run, void (*done)(void* ctx), void (*release)(void* ctx)); /* done is called when a batch finishes, release once nothing references its ctx */
+void pool_submit(const tile* tiles, int count, void* ctx); /* retires the previous batch without waiting for it */
+void pool_cancel(void); /* retires the current batch without starting another */
+void pool_destroy(void);
+int pool_stale(unsigned gen); /* true once a newer batch than gen has been submitted */
+int pool_size(void);
@@ -15,11 +15,24 @@ const char* vs_passthrough = GLSL(
 	}
 );
 
-const char* fs_passthrough = GLSL(
+/* colors the iteration texture through the palette, so recoloring never touches the cpu */
+const char* fs_palette_lookup = GLSL(
 	varying vec2 fs_texcoord;
 	uniform sampler2D fs_texture;
+	uniform sampler1D fs_palette;
+	uniform float fs_max_iter;
 
 	void main(void) {
-		gl_FragColor = texture2D(fs_texture, fs_texcoord);
+		float it = texture2D(fs_texture, fs_texcoord).r;
+
+		if (it < -1.5) it = -2.0 - it; /* pending, but previewed with a nearby count */
+
+		if (it < 0.0) {
+			gl_FragColor = vec4(1.0); /* not computed yet */
+		} else if (it >= fs_max_iter) {
+			gl_FragColor = vec4(0.0); /* never diverged */
+		} else {
+			gl_FragColor = texture1D(fs_palette, it / fs_max_iter);
+		}
 	}
 );
@@ -0,0 +1,187 @@
+/*
+ * vectorized double precision escape-time kernels : sse2 (2 lanes), avx2 (4 lanes), avx-512 (8 lanes)
+ * every lane performs exactly the operations of iterate_d() in the same order, so the iteration counts
+ * match the scalar kernel bit for bit. lanes that escape or fall into a cycle are masked out of the count
+ * and the span stops as soon as no lane is left. lanes iterate in lockstep, so the brent windows of the
+ * periodicity check are shared
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "kernel.h"
+#include "simd.h"
+
+span_kernel iterate_span = NULL;
+const char* iterate_span_name = "scalar";
+const char* const simd_kernel_names[] = { "avx-512", "avx2", "sse2", NULL };
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static void span_sse2(double left, double step, int x0, double ci_s, int n, int max_iter, int period, double eps_s, int* out) {
+	const __m128d four = _mm_set1_pd(MBR_DIVERGE_THRESHOLD), one = _mm_set1_pd(1.0), two = _mm_set1_pd(2.0);
+	const __m128d ci = _mm_set1_pd(ci_s), eps = _mm_set1_pd(eps_s), sign = _mm_set1_pd(-0.0);
+	double counts[2];
+
+	for (int x = 0; x < n; x += 2) {
+		__m128d idx = _mm_set_pd(x0 + x + 1, x0 + x);
+		__m128d cr = _mm_add_pd(_mm_set1_pd(left), _mm_mul_pd(_mm_set1_pd(step), idx));
+		__m128d zr = _mm_setzero_pd(), zi = _mm_setzero_pd(), count = _mm_setzero_pd();
+		__m128d pr = _mm_setzero_pd(), pi = _mm_setzero_pd(), periodic = _mm_setzero_pd();
+		__m128d active = _mm_castsi128_pd(_mm_set1_epi32(-1));
+		int steps = 0, window = period;
+
+		for (int i = 0; i < max_iter; ++i) {
+			__m128d zr2 = _mm_mul_pd(zr, zr), zi2 = _mm_mul_pd(zi, zi);
+
+			active = _mm_and_pd(active, _mm_cmplt_pd(_mm_add_pd(zr2, zi2), four));
+			if (!_mm_movemask_pd(active)) break;
+
+			count = _mm_add_pd(count, _mm_and_pd(active, one));
+
+			zi = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(two, zr), zi), ci);
+			zr = _mm_add_pd(_mm_sub_pd(zr2, zi2), cr);
+
+			if (!period) continue;
+
+			__m128d close = _mm_and_pd(_mm_cmplt_pd(_mm_andnot_pd(sign, _mm_sub_pd(zr, pr)), eps), _mm_cmplt_pd(_mm_andnot_pd(sign, _mm_sub_pd(zi, pi)), eps));
+			close = _mm_and_pd(close, active);
+			periodic = _mm_or_pd(periodic, close);
+			active = _mm_andnot_pd(close, active);
+
+			if (++steps == window) {
+				pr = zr;
+				pi = zi;
+				steps = 0;
+				window *= 2;
+			}
+		}
+
+		_mm_storeu_pd(counts, count);
+		int pm = _mm_movemask_pd(periodic);
+		for (int k = 0; k < 2 && x + k < n; ++k) out[x + k] = pm >> k & 1 ? MBR_PERIODIC : (int) counts[k];
+	}
+}
+
+__attribute__((target("avx2")))
+static void span_avx2(double left, double step, int x0, double ci_s, int n, int max_iter, int period, double eps_s, int* out) {
+	const __m256d four = _mm256_set1_pd(MBR_DIVERGE_THRESHOLD), one = _mm256_set1_pd(1.0), two = _mm256_set1_pd(2.0);
+	const __m256d ci = _mm256_set1_pd(ci_s), eps = _mm256_set1_pd(eps_s), sign = _mm256_set1_pd(-0.0);
+	double counts[4];
+
+	for (int x = 0; x < n; x += 4) {
+		__m256d idx = _mm256_set_pd(x0 + x + 3, x0 + x + 2, x0 + x + 1, x0 + x);
+		__m256d cr = _mm256_add_pd(_mm256_set1_pd(left), _mm256_mul_pd(_mm256_set1_pd(step), idx));
+		__m256d zr = _mm256_setzero_pd(), zi = _mm256_setzero_pd(), count = _mm256_setzero_pd();
+		__m256d pr = _mm256_setzero_pd(), pi = _mm256_setzero_pd(), periodic = _mm256_setzero_pd();
+		__m256d active = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+		int steps = 0, window = period;
+
+		for (int i = 0; i < max_iter; ++i) {
+			__m256d zr2 = _mm256_mul_pd(zr, zr), zi2 = _mm256_mul_pd(zi, zi);
+
+			active = _mm256_and_pd(active, _mm256_cmp_pd(_mm256_add_pd(zr2, zi2), four, _CMP_LT_OQ));
+			if (!_mm256_movemask_pd(active)) break;
+
+			count = _mm256_add_pd(count, _mm256_and_pd(active, one));
+
+			zi = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(two, zr), zi), ci);
+			zr = _mm256_add_pd(_mm256_sub_pd(zr2, zi2), cr);
+
+			if (!period) continue;
+
+			__m256d close = _mm256_and_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign, _mm256_sub_pd(zr, pr)), eps, _CMP_LT_OQ),
+				_mm256_cmp_pd(_mm256_andnot_pd(sign, _mm256_sub_pd(zi, pi)), eps, _CMP_LT_OQ));
+			close = _mm256_and_pd(close, active);
+			periodic = _mm256_or_pd(periodic, close);
+			active = _mm256_andnot_pd(close, active);
+
+			if (++steps == window) {
+				pr = zr;
+				pi = zi;
+				steps = 0;
+				window *= 2;
+			}
+		}
+
+		_mm256_storeu_pd(counts, count);
+		int pm = _mm256_movemask_pd(periodic);
+		for (int k = 0; k < 4 && x + k < n; ++k) out[x + k] = pm >> k & 1 ? MBR_PERIODIC : (int) counts[k];
+	}
+}
+
+__attribute__((target("avx512f")))
+static void span_avx512(double left, double step, int x0, double ci_s, int n, int max_iter, int period, double eps_s, int* out) {
+	const __m512d four = _mm512_set1_pd(MBR_DIVERGE_THRESHOLD), one = _mm512_set1_pd(1.0), two = _mm512_set1_pd(2.0);
+	const __m512d ci = _mm512_set1_pd(ci_s), eps = _mm512_set1_pd(eps_s);
+	double counts[8];
+
+	for (int x = 0; x < n; x += 8) {
+		__m512d idx = _mm512_set_pd(x0 + x + 7, x0 + x + 6, x0 + x + 5, x0 + x + 4, x0 + x + 3, x0 + x + 2, x0 + x + 1, x0 + x);
+		__m512d cr = _mm512_add_pd(_mm512_set1_pd(left), _mm512_mul_pd(_mm512_set1_pd(step), idx));
+		__m512d zr = _mm512_setzero_pd(), zi = _mm512_setzero_pd(), count = _mm512_setzero_pd();
+		__m512d pr = _mm512_setzero_pd(), pi = _mm512_setzero_pd();
+		__mmask8 active = 0xFF, periodic = 0;
+		int steps = 0, window = period;
+
+		for (int i = 0; i < max_iter; ++i) {
+			__m512d zr2 = _mm512_mul_pd(zr, zr), zi2 = _mm512_mul_pd(zi, zi);
+
+			active &= _mm512_cmp_pd_mask(_mm512_add_pd(zr2, zi2), four, _CMP_LT_OQ);
+			if (!active) break;
+
+			count = _mm512_mask_add_pd(count, active, count, one);
+
+			zi = _mm512_add_pd(_mm512_mul_pd(_mm512_mul_pd(two, zr), zi), ci);
+			zr = _mm512_add_pd(_mm512_sub_pd(zr2, zi2), cr);
+
+			if (!period) continue;
+
+			__mmask8 close = _mm512_mask_cmp_pd_mask(active, _mm512_abs_pd(_mm512_sub_pd(zr, pr)), eps, _CMP_LT_OQ)
+				& _mm512_cmp_pd_mask(_mm512_abs_pd(_mm512_sub_pd(zi, pi)), eps, _CMP_LT_OQ);
+			periodic |= close;
+			active &= ~close;
+
+			if (++steps == window) {
+				pr = zr;
+				pi = zi;
+				steps = 0;
+				window *= 2;
+			}
+		}
+
+		_mm512_storeu_pd(counts, count);
+		for (int k = 0; k < 8 && x + k < n; ++k) out[x + k] = periodic >> k & 1 ? MBR_PERIODIC : (int) counts[k];
+	}
+}
+
+span_kernel simd_kernel(const char* name) {
+	__builtin_cpu_init();
+
+	if (!strcmp(name, "avx-512")) return __builtin_cpu_supports("avx512f") ? span_avx512 : NULL;
+	if (!strcmp(name, "avx2")) return __builtin_cpu_supports("avx2") ? span_avx2 : NULL;
+	if (!strcmp(name, "sse2")) return __builtin_cpu_supports("sse2") ? span_sse2 : NULL;
+
+	return NULL;
+}
+
+#else
+
+span_kernel simd_kernel(const char* name) {
+	return NULL;
+}
+
+#endif
+
+void simd_init(void) {
+	/* widest first */
+	for (int i = 0; simd_kernel_names[i]; ++i) {
+		if ((iterate_span = simd_kernel(simd_kernel_names[i]))) {
+			iterate_span_name = simd_kernel_names[i];
+			return;
+		}
+	}
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+/*
+ * vectorized double precision escape-time kernels, chosen at runtime from what the cpu supports
+ */
+
+/* iterates n horizontally adjacent pixels with cr = left + step * (x0 + k), orbits caught in a cycle yield MBR_PERIODIC */
+typedef void (*span_kernel)(double left, double step, int x0, double ci, int n, int max_iter, int period, double eps, int* out);
+
+/* decls */
+
+void simd_init(void);
+span_kernel simd_kernel(const char* name); /* the named kernel if this cpu runs it, NULL otherwise */
+
+extern span_kernel iterate_span; /* NULL when no vector kernel is available on this platform */
+extern const char* iterate_span_name;
+extern const char* const simd_kernel_names[]; /* every kernel simd_kernel knows, widest first, NULL terminated */
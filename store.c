@@ -0,0 +1,387 @@
+/*
+ * on-disk tile store
+ * the file is a short header followed by fixed-size records, each a key and one tile of packed counts.
+ * records are only ever appended, so a torn write at exit loses at most the last one. the whole file is
+ * mapped on open and an in-memory index of the keys is rebuilt from it; appended records are picked up
+ * by remapping when a lookup reaches past the mapping.
+ * several sessions may share a file: appends hold an exclusive flock and first index whatever the others
+ * appended, and every read checks that the record it lands on carries the key it was looked up by.
+ * a file is never truncated in place, one from another layout is replaced by renaming a fresh file over it.
+ * opening a file marks it used, the least recently used files go once the directory outgrows its budget
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <dirent.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "store.h"
+
+#define STORE_MAGIC 0x3154424d /* "MBT1" */
+
+/* types */
+
+typedef struct _store_header {
+	uint32_t magic;
+	int32_t tile_size;
+	int32_t max_iter;
+	int32_t count_bytes; /* 2 or 4 */
+} store_header;
+
+typedef struct _store_record {
+	int32_t level, pad;
+	int64_t tx, ty;
+	/* tile_size * tile_size counts follow */
+} store_record;
+
+typedef struct _store_file {
+	char path[4096];
+	time_t used;
+	off_t size;
+} store_file;
+
+typedef struct _index_slot {
+	int64_t tx, ty;
+	int32_t level;
+	long offset; /* 0 for an empty slot, records never start at 0 */
+} index_slot;
+
+/* globals */
+
+static int fd = -1;
+static int edge, count_bytes;
+static size_t record_size;
+static off_t file_len;
+
+static uint8_t* map;
+static size_t map_len;
+
+static index_slot* slots;
+static unsigned num_slots, used_slots; /* num_slots is a power of two */
+
+/* defs */
+
+static unsigned slot_hash(int level, int64_t tx, int64_t ty) {
+	uint64_t h = 1469598103934665603ull;
+
+	h = (h ^ (uint64_t) level) * 1099511628211ull;
+	h = (h ^ (uint64_t) tx) * 1099511628211ull;
+	h = (h ^ (uint64_t) ty) * 1099511628211ull;
+
+	return (unsigned) (h ^ (h >> 32));
+}
+
+static index_slot* find_slot(int level, int64_t tx, int64_t ty) {
+	unsigned i = slot_hash(level, tx, ty) & (num_slots - 1);
+
+	/* linear probing, the table is kept at most half full */
+	while (slots[i].offset && (slots[i].level != level || slots[i].tx != tx || slots[i].ty != ty)) {
+		i = (i + 1) & (num_slots - 1);
+	}
+
+	return slots + i;
+}
+
+static void index_insert(int level, int64_t tx, int64_t ty, long offset) {
+	index_slot* s;
+
+	if (2 * (used_slots + 1) > num_slots) {
+		index_slot* old = slots;
+		unsigned old_num = num_slots;
+
+		num_slots = num_slots ? num_slots * 2 : 1024;
+		slots = calloc(num_slots, sizeof *slots);
+
+		for (unsigned i = 0; i < old_num; ++i) {
+			if (old[i].offset) *find_slot(old[i].level, old[i].tx, old[i].ty) = old[i];
+		}
+
+		free(old);
+	}
+
+	s = find_slot(level, tx, ty);
+	if (s->offset) return;
+
+	s->level = level;
+	s->tx = tx;
+	s->ty = ty;
+	s->offset = offset;
+	used_slots++;
+}
+
+static int remap(void) {
+	if (map) munmap(map, map_len);
+
+	map = NULL;
+	map_len = file_len;
+	if (!map_len) return 0;
+
+	if ((map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		map = NULL;
+		map_len = 0; /* so the next lookup tries again instead of reading through NULL */
+		return 1;
+	}
+
+	return 0;
+}
+
+static off_t locked_end(void) {
+	struct stat st;
+
+	/* a torn record left by a session that died mid-write is overwritten by the next append */
+	if (fstat(fd, &st)) return file_len;
+	if (st.st_size < (off_t) sizeof(store_header)) return 0;
+
+	return sizeof(store_header) + (st.st_size - sizeof(store_header)) / record_size * record_size;
+}
+
+static void catch_up(off_t end) {
+	store_record r;
+
+	/* records other sessions appended since we last looked */
+	for (; file_len < end; file_len += record_size) {
+		if (pread(fd, &r, sizeof r, file_len) != sizeof r) break;
+		index_insert(r.level, r.tx, r.ty, file_len);
+	}
+}
+
+static int replace_file(const char* path, const store_header* want) {
+	char fresh[4200];
+	int nfd;
+
+	/* sessions still mapping the old file keep reading it, truncating it would fault them */
+	snprintf(fresh, sizeof fresh, "%s.%ld", path, (long) getpid());
+
+	if ((nfd = open(fresh, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) return 1;
+
+	if (pwrite(nfd, want, sizeof *want, 0) != sizeof *want || flock(nfd, LOCK_EX) || rename(fresh, path)) {
+		close(nfd);
+		unlink(fresh);
+		return 1;
+	}
+
+	close(fd);
+	fd = nfd;
+	file_len = sizeof *want;
+
+	return remap();
+}
+
+static int file_order(const void* a, const void* b) {
+	const store_file *x = a, *y = b;
+	return (x->used > y->used) - (x->used < y->used);
+}
+
+static void prune(const char* dir, const char* keep, size_t budget) {
+	store_file* files = NULL;
+	int num_files = 0, removed = 0;
+	size_t total = 0;
+	struct dirent* e;
+	DIR* d;
+
+	if (!(d = opendir(dir))) return;
+
+	while ((e = readdir(d))) {
+		size_t len = strlen(e->d_name);
+		store_file f;
+		struct stat st;
+
+		if (len < 7 || strcmp(e->d_name + len - 6, ".tiles")) continue;
+
+		snprintf(f.path, sizeof f.path, "%s/%s", dir, e->d_name);
+		if (stat(f.path, &st)) continue;
+
+		total += st.st_size;
+		if (!strcmp(f.path, keep)) continue;
+
+		f.used = st.st_mtime;
+		f.size = st.st_size;
+
+		files = realloc(files, (num_files + 1) * sizeof *files);
+		files[num_files++] = f;
+	}
+
+	closedir(d);
+
+	/* another session may still have a removed file open, it keeps working on the unlinked copy */
+	qsort(files, num_files, sizeof *files, file_order);
+
+	for (int i = 0; i < num_files && total > budget; ++i) {
+		if (unlink(files[i].path)) continue;
+
+		total -= files[i].size;
+		removed++;
+	}
+
+	if (removed) printf("tile store dropped %d old files to stay under %zu MB\n", removed, budget >> 20);
+
+	free(files);
+}
+
+int store_open(const char* dir, unsigned long long lattice, int tile_size, int max_iter, size_t budget) {
+	store_header want = { STORE_MAGIC, tile_size, max_iter, max_iter <= UINT16_MAX ? 2 : 4 };
+	char path[4096];
+	struct stat st, named;
+
+	store_close();
+	if (!dir || !*dir) return 0;
+
+	mkdir(dir, 0755); /* fails harmlessly if it exists */
+	snprintf(path, sizeof path, "%s/%016llx.tiles", dir, lattice);
+
+	edge = tile_size;
+	count_bytes = want.count_bytes;
+	record_size = sizeof(store_record) + (size_t) edge * edge * count_bytes;
+
+	/* the lock is held until the index is built, so no other session replaces or appends under us */
+	for (;;) {
+		if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+			printf("tile store %s unavailable\n", path);
+			return 0;
+		}
+
+		flock(fd, LOCK_EX);
+
+		/* a session that replaced the file while we waited for the lock left us holding the old one */
+		if (!fstat(fd, &st) && !stat(path, &named) && st.st_ino == named.st_ino && st.st_dev == named.st_dev) break;
+
+		close(fd);
+	}
+
+	futimens(fd, NULL); /* marks the file used for pruning */
+	file_len = st.st_size;
+
+	if (remap()) {
+		store_close();
+		return 0;
+	}
+
+	/* a new file gets its header, one from another layout is started over */
+	if (!file_len) {
+		if (pwrite(fd, &want, sizeof want, 0) != sizeof want) {
+			store_close();
+			return 0;
+		}
+
+		file_len = sizeof want;
+		remap();
+	} else if (file_len < (off_t) sizeof want || memcmp(map, &want, sizeof want)) {
+		if (replace_file(path, &want)) {
+			store_close();
+			return 0;
+		}
+	}
+
+	/* a torn record at the end is dropped */
+	file_len = sizeof want + (file_len - sizeof want) / record_size * record_size;
+
+	for (off_t off = sizeof want; off < file_len; off += record_size) {
+		const store_record* r = (const store_record*) (map + off);
+		index_insert(r->level, r->tx, r->ty, off);
+	}
+
+	flock(fd, LOCK_UN);
+
+	prune(dir, path, budget);
+
+	return used_slots;
+}
+
+void store_close(void) {
+	if (map) munmap(map, map_len);
+	if (fd >= 0) close(fd);
+
+	free(slots);
+
+	fd = -1;
+	map = NULL;
+	map_len = 0;
+	slots = NULL;
+	num_slots = used_slots = 0;
+}
+
+int store_get(const cache_key* k, float* dst) {
+	const index_slot* s;
+	const store_record* r;
+	const uint8_t* src;
+
+	if (fd < 0 || !num_slots) return 0;
+
+	s = find_slot(k->level, k->tx, k->ty);
+	if (!s->offset) return 0;
+
+	if (s->offset + record_size > map_len && remap()) return 0;
+	if (!map) return 0;
+
+	r = (const store_record*) (map + s->offset);
+	if (r->level != k->level || r->tx != k->tx || r->ty != k->ty) return 0;
+
+	src = (const uint8_t*) (r + 1);
+
+	for (int i = 0; i < edge * edge; ++i) {
+		if (count_bytes == 2) {
+			uint16_t c;
+			memcpy(&c, src + 2 * i, 2);
+			dst[i] = c;
+		} else {
+			uint32_t c;
+			memcpy(&c, src + 4 * i, 4);
+			dst[i] = c;
+		}
+	}
+
+	return 1;
+}
+
+void store_put(const cache_key* k, const float* src, int stride) {
+	store_record* r;
+	uint8_t* dst;
+	off_t end;
+
+	if (fd < 0 || (num_slots && find_slot(k->level, k->tx, k->ty)->offset)) return;
+
+	r = calloc(1, record_size);
+	r->level = k->level;
+	r->tx = k->tx;
+	r->ty = k->ty;
+	dst = (uint8_t*) (r + 1);
+
+	for (int y = 0; y < edge; ++y) {
+		for (int x = 0; x < edge; ++x) {
+			uint32_t c = src[(size_t) y * stride + x];
+
+			if (count_bytes == 2) {
+				uint16_t c16 = c;
+				memcpy(dst + 2 * (y * edge + x), &c16, 2);
+			} else {
+				memcpy(dst + 4 * (y * edge + x), &c, 4);
+			}
+		}
+	}
+
+	if (flock(fd, LOCK_EX)) {
+		free(r);
+		return;
+	}
+
+	/* another session may have appended, or even stored this very tile, since our last look */
+	end = locked_end();
+	if (end >= file_len) catch_up(end);
+
+	if (end == file_len && (!num_slots || !find_slot(k->level, k->tx, k->ty)->offset) && pwrite(fd, r, record_size, file_len) == (ssize_t) record_size) {
+		index_insert(k->level, k->tx, k->ty, file_len);
+		file_len += record_size;
+	}
+
+	flock(fd, LOCK_UN);
+	free(r);
+}
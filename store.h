@@ -0,0 +1,18 @@
+#pragma once
+
+/*
+ * persistent tile store : one append-only file per lattice, memory-mapped when the lattice is opened
+ * tiles hold iteration counts packed to 16 bits when max_iter allows it, so any palette can reuse them
+ * like the cache, only the main thread touches the store; separate processes may share a file
+ */
+
+#include <stddef.h>
+
+#include "cache.h"
+
+/* decls */
+
+int store_open(const char* dir, unsigned long long lattice, int tile_size, int max_iter, size_t budget); /* returns the number of tiles found, budget caps the directory in bytes */
+void store_close(void);
+int store_get(const cache_key* k, float* dst); /* 1 on a hit, dst receives tile_size rows bottom to top */
+void store_put(const cache_key* k, const float* src, int stride); /* appends the tile unless it is already stored */
@@ -0,0 +1,21 @@
+#!/bin/sh
+# mpfr allocation check : a perturbation frame must allocate the same number of mpfr limbs whatever
+# the resolution or iteration depth, so nothing in the per-pixel or per-iteration paths allocates
+# run with make check, or directly as test/alloc_check.sh path/to/mandelbrot-headless
+
+bin=${1:-./mandelbrot-headless}
+center=-0.743643887037151,0.13182590420533
+
+allocs() {
+	"$bin" -o /dev/null -d "" -c $center -z 1e14 "$@" | sed -n 's/^frame finished .* with \([0-9]*\) mpfr allocations.*/\1/p'
+}
+
+small=$(allocs -s 150x100 -i 300)
+large=$(allocs -s 300x200 -i 2000)
+
+echo "mpfr allocations per frame: $small at 150x100 and 300 iterations, $large at 300x200 and 2000 iterations"
+
+if [ -z "$small" ] || [ "$small" != "$large" ]; then
+	echo "allocation count depends on the frame"
+	exit 1
+fi
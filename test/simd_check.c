@@ -0,0 +1,93 @@
+/*
+ * simd kernel check : every span kernel this cpu runs must return the same counts as the scalar iterate_d()
+ * run with make check, exits nonzero on the first view where a kernel disagrees
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "kernel.h"
+#include "simd.h"
+
+/* the scalar reference, built from the same template kernel.c uses */
+#define KERNEL_REAL double
+#define KERNEL_NAME iterate_d
+#include "kernel_real.h"
+
+#define CHECK_WIDTH 301 /* odd, so every kernel also runs a partial vector at the end of a row */
+#define CHECK_HEIGHT 200
+
+/* types */
+
+typedef struct _check_view {
+	const char* name;
+	double left, bottom, step;
+	int max_iter, period;
+} check_view;
+
+/* globals */
+
+const check_view views[] = {
+	{ "full set", -2.5, -1.25, 3.5 / (CHECK_WIDTH - 1), 500, 8 },
+	{ "full set, no periodicity check", -2.5, -1.25, 3.5 / (CHECK_WIDTH - 1), 500, 0 },
+	{ "seahorse valley", -0.7436448, 0.1318252, 1e-9, 2000, 8 },
+	{ "elephant valley", 0.2850, 0.0099, 1e-6, 1000, 8 },
+	{ "double tier limit", -1.7687788330, -0.0017389960, 1e-13, 3000, 8 },
+};
+
+/* decls */
+
+int check_view_kernel(const check_view* v, const char* name, span_kernel run); /* returns the number of mismatching pixels */
+
+/* defs */
+
+int main(void) {
+	int failed = 0, kernels = 0;
+
+	for (int k = 0; simd_kernel_names[k]; ++k) {
+		span_kernel run = simd_kernel(simd_kernel_names[k]);
+
+		if (!run) {
+			printf("%s: not supported here, skipped\n", simd_kernel_names[k]);
+			continue;
+		}
+
+		kernels++;
+
+		for (size_t i = 0; i < sizeof views / sizeof *views; ++i) {
+			int bad = check_view_kernel(views + i, simd_kernel_names[k], run);
+
+			printf("%s: %s, %s\n", simd_kernel_names[k], views[i].name, bad ? "MISMATCH" : "ok");
+			failed |= bad;
+		}
+	}
+
+	if (!kernels) printf("no span kernel to check on this cpu\n");
+
+	return failed ? 1 : 0;
+}
+
+int check_view_kernel(const check_view* v, const char* name, span_kernel run) {
+	int exp, bad = 0;
+	int out[CHECK_WIDTH];
+	double eps;
+
+	/* same tolerance frame_init derives from the pixel spacing */
+	frexp(v->step, &exp);
+	eps = ldexp(1.0, exp - PERIOD_TOLERANCE_SHIFT);
+
+	for (int y = 0; y < CHECK_HEIGHT; ++y) {
+		double ci = v->bottom + v->step * y;
+
+		run(v->left, v->step, 0, ci, CHECK_WIDTH, v->max_iter, v->period, eps, out);
+
+		for (int x = 0; x < CHECK_WIDTH; ++x) {
+			int want = iterate_d(v->left + v->step * x, ci, v->max_iter, v->period, eps);
+
+			if (out[x] != want && bad++ < 5) printf("%s: %s pixel (%d, %d) iterated %d times, scalar %d\n", name, v->name, x, y, out[x], want);
+		}
+	}
+
+	return bad;
+}